@@ -0,0 +1,19 @@
+#ifndef __BENCH_COMMON_H__
+#define __BENCH_COMMON_H__
+
+#include <stdio.h>
+#include <time.h>
+
+static inline double bench_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// print how long each of `ops` operations took, on average
+static inline void bench_report(const char* name, size_t n, size_t ops, double start) {
+  double ns = (bench_now() - start) * 1e9 / ops;
+  printf("  %-24s n=%-8zu %8.1f ns/op\n", name, n, ns);
+}
+
+#endif // __BENCH_COMMON_H__
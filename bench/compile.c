@@ -0,0 +1,110 @@
+#include <stdlib.h>
+#include <string.h>
+#include "../src/compiler.h"
+#include "../src/vm.h"
+#include "common.h"
+#include "compile.h"
+
+// each measurement compiles at least this many constants
+#define MIN_CONSTANTS 300000
+
+// A top-level script with `n` distinct constants (half strings, half
+// numbers), each of which is used twice, along with an identifier that
+// every statement shares:
+//
+//     var x;
+//     x = "s0"; x = 0.5; x = "s0"; x = 0.5;
+//     x = "s1"; x = 1.5; x = "s1"; x = 1.5;
+//     ...
+//
+static char* make_script(size_t n) {
+  size_t cap = 64 + n * 64;
+  char* source = malloc(cap);
+  if (source == NULL) exit(1);
+
+  size_t len = snprintf(source, cap, "var x;\n");
+  for (size_t i = 0; i < n / 2; i++) {
+    len += snprintf(source + len, cap - len,
+                    "x = \"s%zu\"; x = %zu.5; x = \"s%zu\"; x = %zu.5;\n", i, i, i, i);
+  }
+
+  return source;
+}
+
+static void bench_constants(size_t n) {
+  char* source = make_script(n);
+  size_t rounds = (MIN_CONSTANTS + n - 1) / n;
+
+  double start = bench_now();
+  for (size_t r = 0; r < rounds; r++) {
+    ObjFunction* func = compile(source);
+    if (func == NULL || func->chunk.constants.len != n + 1) abort();
+  }
+  bench_report("compile (per constant)", n, rounds * n, start);
+
+  free(source);
+}
+
+// A function with `n` locals, and a closure in it with `n` of its own,
+// which assigns its locals from the outer function's (as upvalues) over
+// and over:
+//
+//     fun outer() {
+//       var v0; var v1; ...
+//       fun inner() {
+//         var w0; var w1; ...
+//         w0 = v0; w1 = v1; ... w0 = v1; ...
+//       }
+//     }
+//
+static char* make_nested_script(size_t n, size_t refs) {
+  size_t cap = 64 + n * 32 + refs * 32;
+  char* source = malloc(cap);
+  if (source == NULL) exit(1);
+
+  size_t len = snprintf(source, cap, "fun outer() {\n");
+  for (size_t i = 0; i < n; i++) len += snprintf(source + len, cap - len, "var v%zu;\n", i);
+
+  len += snprintf(source + len, cap - len, "fun inner() {\n");
+  for (size_t i = 0; i < n; i++) len += snprintf(source + len, cap - len, "var w%zu;\n", i);
+
+  for (size_t i = 0; i < refs / 2; i++) {
+    len += snprintf(source + len, cap - len, "w%zu = v%zu;\n", i % n, (i * 7) % n);
+  }
+
+  snprintf(source + len, cap - len, "}\n}\n");
+  return source;
+}
+
+static void bench_locals(size_t n) {
+  size_t refs = 100000;
+  char* source = make_nested_script(n, refs);
+
+  double start = bench_now();
+  for (size_t r = 0; r < 3; r++) {
+    if (compile(source) == NULL) abort();
+  }
+  bench_report("compile (per reference)", n, 3 * refs, start);
+
+  free(source);
+}
+
+void bench_compile() {
+  printf("compile:\n");
+
+  // (a chunk can hold at most 65535 constants)
+  size_t sizes[] = { 10000, 20000, 40000, 60000 };
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    bench_constants(sizes[i]);
+  }
+
+  // (a function can have at most 256 locals, including its own slot)
+  size_t local_counts[] = { 16, 64, 250 };
+  for (size_t i = 0; i < sizeof(local_counts) / sizeof(local_counts[0]); i++) {
+    bench_locals(local_counts[i]);
+  }
+}
+
+// ---
+
+#undef MIN_CONSTANTS
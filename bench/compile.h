@@ -0,0 +1,6 @@
+#ifndef __BENCH_COMPILE_H__
+#define __BENCH_COMPILE_H__
+
+void bench_compile();
+
+#endif // __BENCH_COMPILE_H__
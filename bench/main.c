@@ -0,0 +1,37 @@
+#include <stdint.h>
+#include <string.h>
+#include "../src/logger.h"
+#include "../src/vm.h"
+#include "compile.h"
+#include "table.h"
+
+typedef struct {
+  const char* name;
+  void (*run)();
+} Bench;
+
+static Bench benches[] = {
+  { "table", bench_table },
+  { "compile", bench_compile },
+};
+
+// usage: bin/bench [name...] (all of them, if no names are given)
+int main(int argc, const char* argv[]) {
+  init_logger();
+  init_vm();
+
+  // benchmarks hold on to objects without rooting them, so never collect
+  vm.next_gc = SIZE_MAX;
+
+  for (size_t i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+    bool selected = argc < 2;
+    for (int j = 1; j < argc; j++) {
+      if (strcmp(argv[j], benches[i].name) == 0) selected = true;
+    }
+
+    if (selected) benches[i].run();
+  }
+
+  free_vm();
+  return 0;
+}
@@ -0,0 +1,169 @@
+#include <stdlib.h>
+#include "../src/object.h"
+#include "../src/table.h"
+#include "../src/vm.h"
+#include "common.h"
+#include "table.h"
+
+// each measurement does at least this many operations
+#define MIN_OPS 4000000
+
+static Value* make_keys(const char* prefix, size_t n) {
+  Value* keys = malloc(sizeof(Value) * n);
+  if (keys == NULL) exit(1);
+
+  char buf[32];
+  for (size_t i = 0; i < n; i++) {
+    int len = snprintf(buf, sizeof(buf), "%s%zu", prefix, i);
+    keys[i] = OBJ_VAL((Obj*) copy_string(buf, len));
+  }
+
+  return keys;
+}
+
+static Value* make_number_keys(size_t n) {
+  Value* keys = malloc(sizeof(Value) * n);
+  if (keys == NULL) exit(1);
+
+  for (size_t i = 0; i < n; i++) keys[i] = NUMBER_VAL(i * 0.5);
+  return keys;
+}
+
+static void bench_size(size_t n) {
+  Value* keys = make_keys("key", n);
+  Value* missing = make_keys("missing", n);
+  Value* numbers = make_number_keys(n);
+  size_t rounds = (MIN_OPS + n - 1) / n;
+
+  Table tab;
+  double start;
+
+  start = bench_now();
+  for (size_t r = 0; r < rounds; r++) {
+    init_table(&tab);
+    for (size_t i = 0; i < n; i++) table_set(&tab, keys[i], NUMBER_VAL(i));
+    if (r + 1 < rounds) free_table(&tab);
+  }
+  bench_report("insert", n, rounds * n, start);
+
+  Value val;
+  double sum = 0;
+
+  start = bench_now();
+  for (size_t r = 0; r < rounds; r++) {
+    for (size_t i = 0; i < n; i++) {
+      if (table_get(&tab, keys[i], &val)) sum += AS_NUMBER(val);
+    }
+  }
+  bench_report("get (hit)", n, rounds * n, start);
+
+  start = bench_now();
+  for (size_t r = 0; r < rounds; r++) {
+    for (size_t i = 0; i < n; i++) {
+      if (table_get(&tab, missing[i], &val)) sum += AS_NUMBER(val);
+    }
+  }
+  bench_report("get (miss)", n, rounds * n, start);
+
+  start = bench_now();
+  for (size_t r = 0; r < rounds; r++) {
+    for (size_t i = 0; i < n; i++) {
+      ObjString* key = AS_STRING(keys[i]);
+      if (table_find_string(&vm.strings, key->chars, key->len, key->hash) != key) abort();
+    }
+  }
+  bench_report("find_string (intern)", n, rounds * n, start);
+
+  start = bench_now();
+  for (size_t r = 0; r < rounds; r++) {
+    for (size_t i = 0; i < n; i++) {
+      table_delete(&tab, keys[i]);
+      table_set(&tab, keys[i], NUMBER_VAL(i));
+    }
+  }
+  bench_report("delete + set", n, rounds * n, start);
+
+  Table nums;
+  init_table(&nums);
+  for (size_t i = 0; i < n; i++) table_set(&nums, numbers[i], NUMBER_VAL(i));
+
+  start = bench_now();
+  for (size_t r = 0; r < rounds; r++) {
+    for (size_t i = 0; i < n; i++) {
+      if (table_get(&nums, numbers[i], &val)) sum += AS_NUMBER(val);
+    }
+  }
+  bench_report("get (number key)", n, rounds * n, start);
+  free_table(&nums);
+
+  // (with only a few keys left, a table that didn't shrink would leave
+  // them scattered across all of its buckets, and its tombstones in the
+  // way of every miss)
+  size_t left = n / 100;
+  for (size_t i = left; i < n; i++) table_delete(&tab, keys[i]);
+
+  start = bench_now();
+  for (size_t r = 0; r < rounds * 100; r++) {
+    for (size_t i = 0; i < left; i++) {
+      if (table_get(&tab, keys[i], &val)) sum += AS_NUMBER(val);
+      if (table_get(&tab, missing[i], &val)) sum += AS_NUMBER(val);
+    }
+  }
+  bench_report("get (after deletes)", n, rounds * 100 * left * 2, start);
+
+  if (sum < 0) printf("%f\n", sum); // (so the lookups can't be optimized away)
+
+  free_table(&tab);
+  free(keys);
+  free(missing);
+  free(numbers);
+
+  // (nothing's ever collected here, so there's no need to remember
+  // which entries point at young keys)
+  vm.remembered_entries.count = 0;
+}
+
+static int compare_doubles(const void* a, const void* b) {
+  double x = *(const double*) a, y = *(const double*) b;
+  return (x > y) - (x < y);
+}
+
+// how long the slowest inserts take while a table grows (each growth
+// can stall an insert for as long as it takes to move every entry)
+static void bench_insert_latency(size_t n) {
+  Value* keys = make_keys("key", n);
+  double* times = malloc(sizeof(double) * n);
+  if (times == NULL) exit(1);
+
+  Table tab;
+  init_table(&tab);
+  for (size_t i = 0; i < n; i++) {
+    double start = bench_now();
+    table_set(&tab, keys[i], NUMBER_VAL(i));
+    times[i] = (bench_now() - start) * 1e9;
+  }
+  free_table(&tab);
+
+  qsort(times, n, sizeof(double), compare_doubles);
+  printf("  %-24s n=%-8zu %8.1f ns p99.9, %.1f us max\n", "insert (latency)", n,
+         times[n - n / 1000 - 1], times[n - 1] / 1000);
+
+  free(times);
+  free(keys);
+  vm.remembered_entries.count = 0;
+}
+
+void bench_table() {
+  printf("table:\n");
+
+  size_t sizes[] = { 1000, 100000, 1000000 };
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    bench_size(sizes[i]);
+  }
+
+  bench_insert_latency(4000000);
+}
+
+// ---
+
+#undef MIN_OPS
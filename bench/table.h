@@ -0,0 +1,6 @@
+#ifndef __BENCH_TABLE_H__
+#define __BENCH_TABLE_H__
+
+void bench_table();
+
+#endif // __BENCH_TABLE_H__
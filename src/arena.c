@@ -0,0 +1,114 @@
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+// blocks are at least this big (anything bigger gets a block to itself)
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+#define ARENA_ALIGN(size) (((size) + 15) & ~((size_t) 15))
+
+struct ArenaBlock {
+  struct ArenaBlock* next;
+  size_t size;
+  // (padded to 16 bytes, so that allocations are aligned)
+};
+
+#define BLOCK_START(block) ((uint8_t*) (block) + ARENA_ALIGN(sizeof(ArenaBlock)))
+
+void init_arena(Arena* arena) {
+  arena->blocks = NULL;
+  arena->spare = NULL;
+  arena->top = NULL;
+  arena->end = NULL;
+  arena->last = NULL;
+}
+
+static void new_block(Arena* arena, size_t min_size) {
+  size_t size = ARENA_ALIGN(sizeof(ArenaBlock)) + min_size;
+  if (size < ARENA_BLOCK_SIZE) size = ARENA_BLOCK_SIZE;
+
+  // reuse a block that was rewound past, if it's big enough
+  ArenaBlock* block = arena->spare;
+  if (block != NULL && block->size >= size) {
+    arena->spare = block->next;
+  } else {
+    block = (ArenaBlock*) malloc(size);
+    if (block == NULL) exit(1);
+    block->size = size;
+  }
+
+  block->next = arena->blocks;
+  arena->blocks = block;
+
+  arena->top = BLOCK_START(block);
+  arena->end = (uint8_t*) block + block->size;
+}
+
+void* arena_allocate(Arena* arena, size_t size) {
+  size = ARENA_ALIGN(size);
+  if ((size_t) (arena->end - arena->top) < size) new_block(arena, size);
+
+  void* ptr = arena->top;
+  arena->top += size;
+  arena->last = ptr;
+  return ptr;
+}
+
+void* arena_grow(Arena* arena, void* ptr, size_t old_len, size_t new_len) {
+  if (new_len <= old_len) return ptr;
+
+  // the most recent allocation can just be extended (if there's room)
+  if (ptr != NULL && ptr == arena->last &&
+      (size_t) (arena->end - (uint8_t*) ptr) >= ARENA_ALIGN(new_len)) {
+    arena->top = (uint8_t*) ptr + ARENA_ALIGN(new_len);
+    return ptr;
+  }
+
+  void* res = arena_allocate(arena, new_len);
+  if (old_len > 0) memcpy(res, ptr, old_len);
+  return res;
+}
+
+void* arena_keep(Arena* arena, const void* ptr, size_t size) {
+  void* res = arena_allocate(arena, size);
+  if (size > 0) memmove(res, ptr, size);
+  return res;
+}
+
+ArenaMark arena_mark(Arena* arena) {
+  return (ArenaMark) { .block = arena->blocks, .top = arena->top, .end = arena->end };
+}
+
+void arena_rewind(Arena* arena, ArenaMark mark) {
+  // blocks started since the mark are kept for reuse, rather than freed
+  while (arena->blocks != mark.block) {
+    ArenaBlock* block = arena->blocks;
+    arena->blocks = block->next;
+    block->next = arena->spare;
+    arena->spare = block;
+  }
+
+  arena->top = mark.top;
+  arena->end = mark.end;
+  arena->last = NULL;
+}
+
+static void free_blocks(ArenaBlock* block) {
+  while (block != NULL) {
+    ArenaBlock* next = block->next;
+    free(block);
+    block = next;
+  }
+}
+
+void free_arena(Arena* arena) {
+  free_blocks(arena->blocks);
+  free_blocks(arena->spare);
+  init_arena(arena);
+}
+
+// ---
+
+#undef ARENA_BLOCK_SIZE
+#undef ARENA_ALIGN
+#undef BLOCK_START
@@ -0,0 +1,65 @@
+#ifndef __CLOX_ARENA_H__
+#define __CLOX_ARENA_H__
+
+#include "common.h"
+#include "memory.h"
+
+typedef struct ArenaBlock ArenaBlock;
+
+/**
+ * Region allocator, for scratch data that all dies at the same time
+ * (like everything the compiler builds up while compiling a script).
+ *
+ * Allocations are bumped off the current block, and can't be freed
+ * individually; instead, the whole arena is freed in one go, or rewound
+ * to an earlier mark. Growing the most recent allocation extends it in
+ * place, so a single growing array doesn't waste any space.
+ */
+typedef struct Arena {
+  ArenaBlock* blocks; // in use, most recent first
+  ArenaBlock* spare;  // rewound past (and so free to reuse)
+  uint8_t*    top;    // next free byte in the current block
+  uint8_t*    end;
+  void*       last;   // the most recent allocation (it can grow in place)
+} Arena;
+
+// a point to rewind an arena back to (see `arena_rewind`)
+typedef struct {
+  ArenaBlock* block;
+  uint8_t*    top;
+  uint8_t*    end;
+} ArenaMark;
+
+// grow an array that lives in `arena`, or on the heap if that's NULL
+#define GROW_ARRAY_IN(arena, type, ptr, old_len, new_len) \
+  ((arena) != NULL \
+    ? (type*) arena_grow(arena, ptr, sizeof(type) * (old_len), sizeof(type) * (new_len)) \
+    : GROW_ARRAY(type, ptr, old_len, new_len))
+
+void init_arena(Arena* arena);
+
+void* arena_allocate(Arena* arena, size_t size);
+
+/** Grow (or shrink) an allocation, moving it if it can't be done in place. */
+void* arena_grow(Arena* arena, void* ptr, size_t old_len, size_t new_len);
+
+ArenaMark arena_mark(Arena* arena);
+
+/**
+ * Free everything allocated since `mark` was taken (so that scratch
+ * data with nested lifetimes can reuse the same memory). The memory
+ * stays readable until the next allocation, so anything that needs to
+ * outlive the rewind can be copied back in (see `arena_keep`).
+ */
+void arena_rewind(Arena* arena, ArenaMark mark);
+
+/**
+ * Copy `size` bytes (which may overlap the arena's free space, after a
+ * rewind) into a fresh allocation.
+ */
+void* arena_keep(Arena* arena, const void* ptr, size_t size);
+
+/** Free everything that was allocated from the arena. */
+void free_arena(Arena* arena);
+
+#endif // __CLOX_ARENA_H__
@@ -1,22 +1,52 @@
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sysexits.h>
+#include "arena.h"
 #include "chunk.h"
+#include "table.h"
+#include "vm.h"
 
 void init_chunk(Chunk* chunk) {
   chunk->code = NULL;
   chunk->len = 0;
   chunk->cap = 0;
+  chunk->arena = NULL;
+  chunk->const_index = NULL;
+  chunk->const_index_cap = 0;
 
   init_value_array(&chunk->constants);
   init_rle_array(&chunk->lines);
 }
 
+void chunk_use_arena(Chunk* chunk, Arena* arena) {
+  chunk->arena = arena;
+  chunk->constants.arena = arena;
+  chunk->lines.arena = arena;
+}
+
+void seal_chunk(Chunk* chunk) {
+  if (chunk->arena == NULL) return;
+
+  uint8_t* code = ALLOCATE(uint8_t, chunk->len);
+  if (chunk->len > 0) memcpy(code, chunk->code, chunk->len);
+
+  chunk->code = code;
+  chunk->cap = chunk->len;
+  chunk->arena = NULL;
+  chunk->const_index = NULL; // (the index is only needed while compiling)
+  chunk->const_index_cap = 0;
+
+  seal_value_array(&chunk->constants);
+  seal_rle_array(&chunk->lines);
+}
+
 void write_chunk(Chunk* chunk, uint8_t byte, size_t line) {
   if (chunk->len == chunk->cap) {
     size_t old_cap = chunk->cap;
     chunk->cap = GROW_CAPACITY(old_cap);
-    chunk->code = GROW_ARRAY(uint8_t, chunk->code, old_cap, chunk->cap);
+    chunk->code = GROW_ARRAY_IN(chunk->arena, uint8_t, chunk->code, old_cap, chunk->cap);
   }
 
   chunk->code[chunk->len] = byte;
@@ -30,13 +60,95 @@ uint16_t add_constant(Chunk* chunk, Value val) {
     exit(EX_SOFTWARE);
   }
 
+  push(val); // growing the constant pool may trigger a collection
   value_array_push(&chunk->constants, val);
+  pop();
+
   return chunk->constants.len - 1;
 }
 
+// -- shared constants
+//
+// The index is an open-addressed hash set of the pool's shareable
+// constants, stored as their index + 1 (so that zeroed slots are empty).
+// It lives in the chunk's arena, and is thrown away with the rest of the
+// compiler's scratch space.
+
+#define CONST_INDEX_MIN 64
+#define CONST_INDEX_LOAD_MAX 0.5
+
+static bool is_shareable(Value val) {
+  if (IS_NUMBER(val)) {
+    double num = AS_NUMBER(val);
+    return !isnan(num) && !(num == 0 && signbit(num));
+  }
+
+  return IS_STRING(val); // (interned, so equal strings are the same object)
+}
+
+// @return the index's slot for `val`: either the one holding it, or the
+//         empty one where it would go
+static uint16_t* find_const_slot(Chunk* chunk, Value val) {
+  size_t mask = chunk->const_index_cap - 1;
+  for (size_t i = table_hash_key(val) & mask;; i = (i + 1) & mask) {
+    uint16_t* slot = &chunk->const_index[i];
+    if (*slot == 0 || values_equal(chunk->constants.values[*slot - 1], val)) return slot;
+  }
+}
+
+static void grow_const_index(Chunk* chunk) {
+  size_t cap = chunk->const_index_cap < CONST_INDEX_MIN
+               ? CONST_INDEX_MIN : chunk->const_index_cap * 2;
+
+  // (the old index is left behind, for the arena to reclaim)
+  chunk->const_index = arena_allocate(chunk->arena, sizeof(uint16_t) * cap);
+  chunk->const_index_cap = cap;
+  memset(chunk->const_index, 0, sizeof(uint16_t) * cap);
+
+  for (size_t i = 0; i < chunk->constants.len; i++) {
+    Value val = chunk->constants.values[i];
+    if (!is_shareable(val)) continue;
+
+    uint16_t* slot = find_const_slot(chunk, val);
+    if (*slot == 0) *slot = (uint16_t) (i + 1);
+  }
+}
+
+uint16_t add_shared_constant(Chunk* chunk, Value val) {
+  if (!is_shareable(val)) return add_constant(chunk, val);
+
+  if (chunk->arena == NULL) {
+    uint16_t existing;
+    bool found = value_array_find_index(&chunk->constants, val, &existing);
+    return found ? existing : add_constant(chunk, val);
+  }
+
+  // (keep the index at most half full, counting the new constant)
+  if ((chunk->constants.len + 1) > chunk->const_index_cap * CONST_INDEX_LOAD_MAX) {
+    grow_const_index(chunk);
+  }
+
+  uint16_t* slot = find_const_slot(chunk, val);
+  if (*slot != 0) return *slot - 1;
+
+  uint16_t constant = add_constant(chunk, val);
+  *slot = constant + 1;
+  return constant;
+}
+
+void truncate_chunk(Chunk* chunk, size_t len) {
+  truncate_rle_array(&chunk->lines, chunk->len - len);
+  chunk->len = len;
+}
+
 void free_chunk(Chunk* chunk) {
-  FREE_ARRAY(uint8_t, chunk->code, chunk->cap);
+  if (chunk->arena == NULL) FREE_ARRAY(uint8_t, chunk->code, chunk->cap);
   free_value_array(&chunk->constants);
   free_rle_array(&chunk->lines);
   init_chunk(chunk); // leave in a clean, empty state
 }
+
+// ---
+
+#undef CONST_INDEX_MIN
+#undef CONST_INDEX_LOAD_MAX
@@ -43,6 +43,16 @@ typedef enum {
   OP_NOT,
   OP_NEGATE,
 
+  // -- intrinsics --
+  // natives that are common in hot loops compile straight
+  // to these, rather than going through a native call
+  OP_SQRT,
+  OP_FLOOR,
+  OP_ABS,
+  OP_MIN,
+  OP_MAX,
+  OP_CLOCK,
+
   // -- statements --
   OP_PRINT,
 
@@ -68,14 +78,43 @@ typedef struct {
 
   // run-length encoded array containing line no. info
   RLEArray lines;
+
+  Arena* arena; // where the chunk's arrays live while it's being compiled
+                // (NULL once they're on the heap, see `seal_chunk`)
+
+  // (while the chunk's in an arena) hash index of the constants that
+  // can be shared, see `add_shared_constant`
+  uint16_t* const_index; // constant index + 1, or 0 for an empty slot
+  size_t    const_index_cap;
 } Chunk;
 
 void init_chunk(Chunk* chunk);
 
+/**
+ * Keep the chunk's arrays in `arena` while it's written, rather than
+ * growing them on the heap (which is wasted effort for scratch data).
+ */
+void chunk_use_arena(Chunk* chunk, Arena* arena);
+
+/** Copy the chunk's arrays out of its arena, onto the heap (at exact size). */
+void seal_chunk(Chunk* chunk);
+
 void write_chunk(Chunk* chunk, uint8_t byte, size_t line);
 
 uint16_t add_constant(Chunk* chunk, Value val);
 
+/**
+ * Like `add_constant`, but reuse an equal constant if there's already
+ * one in the pool. Only strings and numbers are shared, and not -0 (which
+ * is equal to 0, but prints differently) or NaN (which isn't equal to
+ * anything). While the chunk's in an arena, the pool is looked up through
+ * a hash index, otherwise it's scanned.
+ */
+uint16_t add_shared_constant(Chunk* chunk, Value val);
+
+/** Discard any code written after the first `len` bytes. */
+void truncate_chunk(Chunk* chunk, size_t len);
+
 void free_chunk(Chunk* chunk);
 
 #endif // __CLOX_CHUNK_H__
@@ -4,6 +4,8 @@
 // #define DEBUG_TRACE_EXEC (print ops/stack to stdout as they're interpreted)
 // #define DEBUG_PRINT_CODE (print code to stdout after compilation)
 // #define DEBUG_BACKTRACE  (print a backtrace to stderr on segfault)
+// #define DEBUG_STRESS_GC  (collect garbage on every allocation)
+// #define DEBUG_LOG_GC     (print GC activity to stderr)
 
 #define UINT8_COUNT (UINT8_MAX + 1)
 
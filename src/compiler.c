@@ -1,8 +1,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "arena.h"
 #include "chunk.h"
 #include "compiler.h"
+#include "gc.h"
+#include "mem_stats.h"
+#include "natives.h"
+#include "number.h"
 #include "scanner.h"
 #include "value.h"
 
@@ -43,8 +48,8 @@ typedef struct {
   Precedence precedence;
 } ParseRule;
 
-// Local variables are stored on the stack and resolved
-// at runtime by walking and comparing by `name`.
+// Local variables are stored on the stack, and their names
+// are resolved to stack slots at compile time (see `Symbol`).
 //
 // Locals are associated with the _scope_ in which they
 // were defined, marked by their `depth`. The top-level
@@ -52,10 +57,32 @@ typedef struct {
 // that increases the depth by 1.
 typedef struct {
   Token name;
+  uint32_t hash; // (of `name`)
   int depth;
+  int shadowed;     // the local this one shadows, if any (see `Symbol`)
   bool is_captured; // whether or not this local is captured by a closure
 } Local;
 
+// Each compiler keeps a hash of the local names in scope, mapping each
+// one to the innermost local with that name (so that resolving a name
+// doesn't mean comparing it against every local). A local that shadows
+// another remembers it, and puts it back when it goes out of scope.
+//
+//     {
+//       var a = 1;     // a -> 1
+//       {
+//         var a = 2;   // a -> 2 (shadowing 1)
+//       }              // a -> 1
+//     }                // a -> (nothing)
+//
+// Names stay in the hash once they're out of scope, since there's never
+// more of them than there are distinct names in the function.
+typedef struct {
+  Token name;    // (`start` is NULL for an empty slot)
+  uint32_t hash;
+  int local;     // the innermost local with this name, or UNRESOLVED_LOCAL
+} Symbol;
+
 typedef struct {
   uint8_t index; // the captured variable's stack index
   bool is_local; // whether the captured variable is local
@@ -75,16 +102,35 @@ typedef struct Compiler {
   ObjFunction* function;
   FunctionType type;
 
-  Local locals[UINT8_COUNT];
+  Local* locals;
   int local_count;
+  int local_cap;
   int scope_depth;
 
-  Upvalue upvalues[UINT8_COUNT];
+  Symbol* symbols; // names of the locals (see `Symbol`)
+  int symbol_count;
+  int symbol_cap;
+
+  // Upvalues are allocated up front, since they're added to by the
+  // functions nested inside this one (whose scratch space is freed before
+  // this function's is). Each one is also indexed by what it captures
+  // (see `add_upvalue`).
+  Upvalue* upvalues;     // (`function->upvalue_count` of them)
+  uint16_t* upvalue_ids; // (upvalue index + 1, or 0 if it isn't captured yet)
+
+  ArenaMark scratch; // where this compiler's scratch space starts
 } Compiler;
 
 Parser parser;
 Compiler* current = NULL;
 
+// Scratch space for compilation (each compiler's locals and upvalues,
+// along with the chunk being written). Chunks are copied out at their
+// exact size as each function is finished. Since functions nest, once
+// one is finished, everything allocated after it started is freed, so
+// the arena only ever holds the functions that are still open.
+static Arena arena;
+
 static Chunk* current_chunk() { return &current->function->chunk; }
 
 static void init_parser() {
@@ -217,10 +263,21 @@ static void patch_jump(int offset) {
 }
 
 static void emit_constant(Value val) {
-  uint16_t constant = add_constant(current_chunk(), val);
+  uint16_t constant = add_shared_constant(current_chunk(), val);
   emit_constant_op(constant, OP_CONST, OP_CONST_LONG);
 }
 
+// emit a compile-time value, using the dedicated ops where possible
+static void emit_literal(Value val) {
+  if (IS_NIL(val)) {
+    emit_byte(OP_NIL);
+  } else if (IS_BOOL(val)) {
+    emit_byte(AS_BOOL(val) ? OP_TRUE : OP_FALSE);
+  } else {
+    emit_constant(val);
+  }
+}
+
 static void emit_return() {
   emit_byte(OP_NIL); // functions implicitly return nil (if no value is specified)
   emit_byte(OP_RETURN);
@@ -228,12 +285,33 @@ static void emit_return() {
 
 static void init_compiler(Compiler* compiler, FunctionType type) {
   compiler->enclosing = current;
+  compiler->scratch = arena_mark(&arena);
   compiler->function = new_function();
   compiler->type = type;
+  compiler->local_cap = GROW_CAPACITY(0);
+  compiler->locals = (Local*) arena_allocate(&arena, sizeof(Local) * compiler->local_cap);
   compiler->local_count = 0;
   compiler->scope_depth = 0;
+  compiler->symbols = NULL;
+  compiler->symbol_count = 0;
+  compiler->symbol_cap = 0;
+  compiler->upvalues = NULL;
+  compiler->upvalue_ids = NULL;
   current = compiler;
 
+  // the functions nested in this one add to its upvalues while they're
+  // being compiled (above their own arena marks), so the array is
+  // allocated at full size here, rather than grown into space that
+  // they'll rewind (the top-level script has nothing to capture)
+  if (type != TYPE_SCRIPT) {
+    size_t ids_size = sizeof(uint16_t) * UINT8_COUNT * 2;
+    compiler->upvalues = (Upvalue*) arena_allocate(&arena, sizeof(Upvalue) * UINT8_COUNT);
+    compiler->upvalue_ids = (uint16_t*) arena_allocate(&arena, ids_size);
+    memset(compiler->upvalue_ids, 0, ids_size);
+  }
+
+  chunk_use_arena(&compiler->function->chunk, &arena);
+
   // we've just parsed the function's name (that's what kicks off compilation
   // with a fresh compiler instance), use it as this compiler's name
   if (type != TYPE_SCRIPT) {
@@ -243,15 +321,19 @@ static void init_compiler(Compiler* compiler, FunctionType type) {
   // the compiler claims the first stack slot for its own usage
   Local* local = &current->locals[current->local_count++];
   local->depth = 0;
+  local->shadowed = UNRESOLVED_LOCAL;
   local->is_captured = false;
   local->name.start = "";
   local->name.len = 0;
+  local->hash = 0; // (it can't be referred to, so it isn't in `symbols`)
 }
 
 static ObjFunction* end_compiler() {
   emit_return();
 
   ObjFunction* func = current->function;
+  seal_chunk(&func->chunk); // (while the function's still a root)
+  count_payload(OBJ_FUNCTION, object_payload_size((Obj*) func));
 
 #ifdef DEBUG_PRINT_CODE
   if (!parser.had_error) {
@@ -260,11 +342,95 @@ static ObjFunction* end_compiler() {
   }
 #endif
 
+  // free this function's scratch space (and that of anything nested in
+  // it), keeping just the upvalues, which are needed to emit its closure
+  arena_rewind(&arena, current->scratch);
+  current->upvalues = (Upvalue*) arena_keep(&arena, current->upvalues,
+                                            sizeof(Upvalue) * func->upvalue_count);
+
   current = current->enclosing; // shift compilation back to the parent
 
   return func;
 }
 
+// -- local names (see `Symbol`)
+
+#define SYMBOLS_MIN 16
+
+static bool identifiers_equal(Token* a, Token* b) {
+  if (a->len != b->len) return false;
+  return memcmp(a->start, b->start, a->len) == 0;
+}
+
+static uint32_t hash_name(Token* name) {
+  return hash_string(name->start, name->len); // (as for strings)
+}
+
+// @return the name's slot in the compiler's symbols (or the empty slot
+//         where it would go), which mustn't be full
+static Symbol* find_symbol(Compiler* compiler, Token* name, uint32_t hash) {
+  int mask = compiler->symbol_cap - 1;
+
+  for (int i = hash & mask;; i = (i + 1) & mask) {
+    Symbol* sym = &compiler->symbols[i];
+    if (sym->name.start == NULL) return sym;
+    if (sym->hash == hash && identifiers_equal(&sym->name, name)) return sym;
+  }
+}
+
+static void grow_symbols(Compiler* compiler) {
+  Symbol* old = compiler->symbols;
+  int old_cap = compiler->symbol_cap;
+
+  // (the old symbols are left behind, for the arena to reclaim)
+  compiler->symbol_cap = old_cap < SYMBOLS_MIN ? SYMBOLS_MIN : old_cap * 2;
+  compiler->symbols = (Symbol*) arena_allocate(&arena, sizeof(Symbol) * compiler->symbol_cap);
+  memset(compiler->symbols, 0, sizeof(Symbol) * compiler->symbol_cap);
+
+  for (int i = 0; i < old_cap; i++) {
+    if (old[i].name.start == NULL) continue;
+    *find_symbol(compiler, &old[i].name, old[i].hash) = old[i];
+  }
+}
+
+// @return the innermost local with the given name, or UNRESOLVED_LOCAL
+static int find_local(Compiler* compiler, Token* name) {
+  if (compiler->symbol_count == 0) return UNRESOLVED_LOCAL;
+
+  Symbol* sym = find_symbol(compiler, name, hash_name(name));
+  return sym->name.start == NULL ? UNRESOLVED_LOCAL : sym->local;
+}
+
+// make the name of the latest local refer to it
+static void bind_local(Compiler* compiler) {
+  int idx = compiler->local_count - 1;
+  Local* local = &compiler->locals[idx];
+  local->hash = hash_name(&local->name);
+
+  // (keep the symbols at most half full)
+  if ((compiler->symbol_count + 1) * 2 > compiler->symbol_cap) grow_symbols(compiler);
+
+  Symbol* sym = find_symbol(compiler, &local->name, local->hash);
+  if (sym->name.start == NULL) {
+    sym->name = local->name;
+    sym->hash = local->hash;
+    sym->local = UNRESOLVED_LOCAL;
+    compiler->symbol_count++;
+  }
+
+  local->shadowed = sym->local;
+  sym->local = idx;
+}
+
+// (as the latest local goes out of scope) give its name back to
+// whichever local it was shadowing
+static void unbind_local(Compiler* compiler) {
+  Local* local = &compiler->locals[compiler->local_count - 1];
+  find_symbol(compiler, &local->name, local->hash)->local = local->shadowed;
+}
+
+// --
+
 static void begin_scope() {
   current->scope_depth++;
 }
@@ -281,6 +447,7 @@ static void end_scope() {
       emit_byte(OP_POP);
     }
 
+    unbind_local(current);
     current->local_count--;
   }
 }
@@ -299,7 +466,7 @@ static void grouping(bool can_assign) {
 }
 
 static void number(bool can_assign) {
-  double val = strtod(parser.previous.start, NULL);
+  double val = parse_number(parser.previous.start, parser.previous.len);
   emit_constant(NUMBER_VAL(val));
 }
 
@@ -313,19 +480,13 @@ static void string(bool can_assign) {
   Value str = OBJ_VAL((Obj*) copy_string(parser.previous.start + 1,
                                          parser.previous.len - 2));
 
-  uint16_t constant;
-  bool found = value_array_find_index(&current_chunk()->constants, str, &constant);
-  if (!found) constant = add_constant(current_chunk(), str);
-
-  emit_constant_op(constant, OP_CONST, OP_CONST_LONG);
+  emit_constant(str);
 }
 
 static uint16_t identifier_constant(Token* name) {
   Value str = OBJ_VAL((Obj*) copy_string(name->start, name->len));
 
-  uint16_t existing;
-  bool found = value_array_find_index(&current_chunk()->constants, str, &existing);
-  return found ? existing : add_constant(current_chunk(), str);
+  return add_shared_constant(current_chunk(), str);
 }
 
 static uint8_t argument_list() { // parse 0 or more argument expressions for a function
@@ -343,37 +504,33 @@ static uint8_t argument_list() { // parse 0 or more argument expressions for a f
   return argc;
 }
 
-static bool identifiers_equal(Token* a, Token* b) {
-  if (a->len != b->len) return false;
-  return memcmp(a->start, b->start, a->len) == 0;
-}
-
 static int resolve_local(Compiler* compiler, Token* name) {
-  for (int i = compiler->local_count - 1; i >= 0; i--) {
-    Local* local = &compiler->locals[i];
-    if (identifiers_equal(name, &local->name)) {
-      if (local->depth == DEPTH_UNITIALIZED) {
-        error("Can't read local variable in its own initializer.");
-      }
+  int i = find_local(compiler, name);
 
-      return i;
-    }
+  if (i != UNRESOLVED_LOCAL && compiler->locals[i].depth == DEPTH_UNITIALIZED) {
+    error("Can't read local variable in its own initializer.");
   }
 
-  return UNRESOLVED_LOCAL;
+  return i;
 }
 
 static void add_local(Token name) {
-  // we could dynamically allocate additional storage for locals, but
-  // for now let's just error out (256 should be a reasonable default)
+  // locals are addressed by a single byte operand
   if (current->local_count == UINT8_COUNT) {
     error("Too many local variables in function.");
     return;
   }
 
+  if (current->local_count == current->local_cap) {
+    int old_cap = current->local_cap;
+    current->local_cap = GROW_CAPACITY(old_cap);
+    current->locals = GROW_ARRAY_IN(&arena, Local, current->locals, old_cap, current->local_cap);
+  }
+
   Local* local = &current->locals[current->local_count++];
   local->name = name;
   local->is_captured = false;
+  bind_local(current);
   local->depth = DEPTH_UNITIALIZED; // locals are marked as uninitialized until
                                     // their initializer expression has been parsed,
                                     // so that this sort of thing is marked as invalid
@@ -393,12 +550,9 @@ static void add_local(Token name) {
 static int add_upvalue(Compiler* compiler, uint8_t index, bool is_local) {
   int upvalue_count = compiler->function->upvalue_count;
 
-  for (int i = 0; i < upvalue_count; i++) {
-    Upvalue* uv = &compiler->upvalues[i];
-    if (uv->index == index && uv->is_local == is_local) {
-      return i; // share a matching upvalue that's alredy been recorded
-    }
-  }
+  // share a matching upvalue that's already been recorded
+  uint16_t* id = &compiler->upvalue_ids[index * 2 + is_local];
+  if (*id != 0) return *id - 1;
 
   if (upvalue_count == UINT8_COUNT) {
     error("Too many closure variables in function.");
@@ -407,6 +561,7 @@ static int add_upvalue(Compiler* compiler, uint8_t index, bool is_local) {
 
   compiler->upvalues[upvalue_count].is_local = is_local;
   compiler->upvalues[upvalue_count].index = index;
+  *id = upvalue_count + 1;
 
   return compiler->function->upvalue_count++;
 }
@@ -459,14 +614,12 @@ static void declare_variable() {
 
   Token* name = &parser.previous;
 
-  for (int i = current->local_count - 1; i >= 0; i--) {
-    Local* local = &current->locals[i];             // starting at the top of the stack, walk
-    if (local->depth != DEPTH_UNITIALIZED &&        // backwards and make sure this is the first
-        local->depth < current->scope_depth) break; // time we've seen this declaration in this block
-
-    if (identifiers_equal(name, &local->name)) {
-      error("Cannot redeclare block-scoped variable.");
-    }
+  // make sure this is the first time we've seen this declaration in this
+  // block (if the name's in use, its innermost local is the one to check)
+  int i = find_local(current, name);
+  if (i != UNRESOLVED_LOCAL && (current->locals[i].depth == DEPTH_UNITIALIZED ||
+                                current->locals[i].depth == current->scope_depth)) {
+    error("Cannot redeclare block-scoped variable.");
   }
 
   add_local(*name);
@@ -499,19 +652,182 @@ static void named_global(uint16_t arg, bool can_assign) {
   }
 }
 
+// constants are replaced by their value wherever they're referenced
+static void named_const(Value val, bool can_assign) {
+  if (can_assign && match(TOKEN_EQUAL)) {
+    error("Cannot assign to constant.");
+    return;
+  }
+
+  emit_literal(val);
+}
+
+// look a name up in a table keyed by interned strings, without
+// allocating (every reference to a global checks these tables)
+static bool lookup_name(Table* tab, Token* name, Value* out) {
+  ObjString* key = table_find_string(tab, name->start, name->len, hash_name(name));
+  return key != NULL && table_get(tab, OBJ_VAL((Obj*) key), out);
+}
+
+static bool lookup_const(Token* name, Value* out) {
+  return lookup_name(&vm.consts, name, out);
+}
+
+// look up the native that a global name refers to, if any
+static ObjNative* find_native(Token* name) {
+  Value val;
+  if (!lookup_name(&vm.globals, name, &val) || !IS_NATIVE(val)) return NULL;
+  return AS_NATIVE(val);
+}
+
+// called whenever a global is (re)defined; once a native's name refers
+// to something else, calls to it have to go through the global
+static void shadow_native(Token* name) {
+  ObjNative* native = find_native(name);
+  if (native == NULL) return;
+
+  if (vm.natives_inlined & (1ull << native->id)) {
+    error("Cannot redefine a native after calls to it have been inlined.");
+  }
+
+  vm.natives_shadowed |= 1ull << native->id;
+}
+
+static bool is_local_anywhere(Token* name) {
+  for (Compiler* compiler = current; compiler != NULL; compiler = compiler->enclosing) {
+    if (find_local(compiler, name) != UNRESOLVED_LOCAL) return true;
+  }
+
+  return false;
+}
+
+// If every argument compiled to a single constant load, a call to a pure
+// native can be evaluated right now, and the call (everything emitted
+// since `call_start`) replaced with its result.
+//
+//     OP_GET_GLOBAL 'len'          OP_CONST 5
+//     OP_CONST      'hello'   =>
+//     OP_CALL       1
+//
+// @return false if the call can't be folded (nothing is changed)
+static bool fold_native_call(ObjNative* native, uint8_t argc,
+                             size_t call_start, size_t args_start) {
+  if (native->arity != NATIVE_VARIADIC && argc != native->arity) return false;
+
+  Chunk* chunk = current_chunk();
+  Value args[UINT8_COUNT];
+  size_t offset = args_start;
+
+  for (int i = 0; i < argc; i++) {
+    if (offset >= chunk->len) return false;
+
+    switch (chunk->code[offset]) {
+      case OP_CONST:
+        args[i] = chunk->constants.values[chunk->code[offset + 1]];
+        offset += 2;
+        break;
+      case OP_CONST_LONG:
+        args[i] = chunk->constants.values[(chunk->code[offset + 1] << 8) |
+                                          chunk->code[offset + 2]];
+        offset += 3;
+        break;
+      case OP_NIL:   args[i] = NIL_VAL;         offset++; break;
+      case OP_TRUE:  args[i] = BOOL_VAL(true);  offset++; break;
+      case OP_FALSE: args[i] = BOOL_VAL(false); offset++; break;
+      default: return false; // argument isn't a constant
+    }
+  }
+
+  if (offset != chunk->len) return false;
+
+  // a native that allocates could set off a collection, which may move
+  // its arguments (and then its result), so those have to be somewhere
+  // the GC can see them, i.e. on the VM's stack
+  bool allocates = !(native->flags & NATIVE_NO_ALLOC);
+  Value* argv = args;
+  if (allocates) {
+    for (int i = 0; i < argc; i++) push(args[i]);
+    argv = vm.stack_top - argc;
+  }
+
+  // if the native fails, leave the call in place so that the
+  // error is reported at runtime like it normally would be
+  Value result;
+  bool ok = native->function(argc, argv, &result);
+  if (allocates) vm.stack_top -= argc;
+  if (!ok) return false;
+
+  if (allocates) push(result);
+  truncate_chunk(chunk, call_start);
+  emit_literal(result);
+  if (allocates) pop();
+
+  return true;
+}
+
+// Compile `name(args...)` where `name` refers to a native that the
+// compiler knows how to optimize: intrinsics compile to their own op,
+// and pure natives with constant arguments are folded.
+//
+// @return false if `name` isn't such a native (nothing is consumed)
+static bool native_call(Token* name) {
+  if (is_local_anywhere(name)) return false;
+
+  ObjNative* native = find_native(name);
+  if (native == NULL || (vm.natives_shadowed & (1ull << native->id))) return false;
+
+  bool intrinsic = native->flags & NATIVE_INTRINSIC;
+  bool pure = native->flags & NATIVE_PURE;
+  if (!intrinsic && !pure) return false;
+
+  size_t call_start = current_chunk()->len;
+  if (!intrinsic) named_global(identifier_constant(name), false);
+
+  size_t args_start = current_chunk()->len;
+  advance(); // consume the opening TOKEN_LEFT_PAREN
+  uint8_t argc = argument_list();
+
+  if (pure && fold_native_call(native, argc, call_start, args_start)) {
+    vm.natives_inlined |= 1ull << native->id;
+  } else if (intrinsic) {
+    vm.natives_inlined |= 1ull << native->id;
+
+    if (argc != native->arity) {
+      char message[64];
+      snprintf(message, sizeof(message), "Expected %d arguments but got %d.",
+               native->arity, argc);
+      error(message);
+    }
+
+    emit_byte(natives[native->id].intrinsic);
+  } else {
+    emit_bytes(OP_CALL, argc);
+  }
+
+  return true;
+}
+
 static void named_variable(Token name, bool can_assign) {
+  Value const_val;
+
   int local_arg = resolve_local(current, &name);
   if (local_arg != UNRESOLVED_LOCAL) {
     named_local((uint8_t) local_arg, can_assign);
   } else if ((local_arg = resolve_upvalue(current, &name)) != UNRESOLVED_LOCAL) {
     named_upvalue((uint8_t) local_arg, can_assign);
+  } else if (lookup_const(&name, &const_val)) {
+    named_const(const_val, can_assign);
   } else {
+    if (can_assign && check(TOKEN_EQUAL)) shadow_native(&name);
+
     uint16_t arg = identifier_constant(&name);
     named_global(arg, can_assign);
   }
 }
 
 static void variable(bool can_assign) {
+  if (check(TOKEN_LEFT_PAREN) && native_call(&parser.previous)) return;
+
   named_variable(parser.previous, can_assign);
 }
 
@@ -650,7 +966,17 @@ static uint16_t parse_variable(const char* err_message) {
   if (current->scope_depth > 0) return 0; // store it in the constants table, just
                                           // return a dummy value
 
-  return identifier_constant(&parser.previous);
+  Value existing;
+  if (lookup_const(&parser.previous, &existing)) {
+    error("Cannot redeclare constant.");
+  }
+
+  shadow_native(&parser.previous);
+
+  // (the name's already interned, and held by the chunk)
+  uint16_t arg = identifier_constant(&parser.previous);
+  table_set(&vm.declared, current_chunk()->constants.values[arg], BOOL_VAL(true));
+  return arg;
 }
 
 static inline void mark_initialized() {
@@ -712,14 +1038,15 @@ static void function(FunctionType type) {
   // output bytecode for the closure (OP_CLOSURE, followed by constant
   // index that refers to an Object* for the compiled function)
   ObjFunction* func = end_compiler();
-  emit_byte(OP_CLOSURE);
 
+  // add the function to the enclosing chunk before emitting anything
+  // else, since it's no longer reachable from its (ended) compiler
   uint16_t constant = add_constant(current_chunk(), OBJ_VAL((Obj*) func));
   if (constant >= UINT8_MAX) {
     error("Too many constants in chunk.");
   }
 
-  emit_byte((uint8_t) constant);
+  emit_bytes(OP_CLOSURE, (uint8_t) constant);
 
   // output bytecode for any captured upvalues
   for (int i = 0; i < func->upvalue_count; i++) {
@@ -926,6 +1253,7 @@ static void synchronize() {
                                                          // let's try resuming compilation, or...
     switch (parser.current.type) {
       case TOKEN_CLASS:
+      case TOKEN_CONST:
       case TOKEN_FUN:
       case TOKEN_VAR:
       case TOKEN_FOR:
@@ -964,10 +1292,86 @@ static void var_declaration() {
   define_variable(global);
 }
 
+// Parse the initializer of a `const` declaration, which must be a
+// literal (optionally negated, if it's a number) or another constant.
+//
+// @return false if the initializer isn't a compile-time constant
+static bool constant_expression(Value* out) {
+  bool negate = match(TOKEN_MINUS);
+
+  switch (parser.current.type) {
+    case TOKEN_NUMBER:
+      advance();
+      *out = NUMBER_VAL(parse_number(parser.previous.start, parser.previous.len));
+      break;
+    case TOKEN_STRING:
+      advance();
+      *out = OBJ_VAL((Obj*) copy_string(parser.previous.start + 1,
+                                        parser.previous.len - 2));
+      break;
+    case TOKEN_TRUE:  advance(); *out = BOOL_VAL(true);  break;
+    case TOKEN_FALSE: advance(); *out = BOOL_VAL(false); break;
+    case TOKEN_NIL:   advance(); *out = NIL_VAL;         break;
+    case TOKEN_IDENTIFIER:
+      advance();
+      if (!lookup_const(&parser.previous, out)) return false;
+      break;
+    default:
+      return false;
+  }
+
+  if (!negate) return true;
+  if (!IS_NUMBER(*out)) return false;
+
+  *out = NUMBER_VAL(-AS_NUMBER(*out));
+  return true;
+}
+
+// constants are only allowed at the top level, so they never need to
+// be scoped (and inner scopes can still shadow them with locals)
+//
+//     const LIMIT = 100;
+//
+static void const_declaration() {
+  if (current->type != TYPE_SCRIPT || current->scope_depth > 0) {
+    error("Constants can only be declared at the top level.");
+  }
+
+  consume(TOKEN_IDENTIFIER, "Expected constant name.");
+  Token name = parser.previous;
+  shadow_native(&name);
+
+  Value existing;
+  if (lookup_const(&name, &existing)) {
+    error("Cannot redeclare constant.");
+  } else if (lookup_name(&vm.declared, &name, &existing)) {
+    error("Cannot redeclare global variable as constant.");
+  }
+
+  consume(TOKEN_EQUAL, "Expected '=' after constant name.");
+
+  Value val;
+  if (!constant_expression(&val) || !check(TOKEN_SEMICOLON)) {
+    error_at_current("Constant initializer must be a compile-time constant.");
+    return;
+  }
+
+  consume(TOKEN_SEMICOLON, "Expected ';' after constant declaration.");
+
+  push(val); // keep the value reachable while its name is allocated
+  push(OBJ_VAL((Obj*) copy_string(name.start, name.len)));
+  table_set(&vm.consts, vm.stack_top[-1], val);
+  pop();
+  pop();
+}
+
 static void declaration() {
   if (match(TOKEN_FUN))
     fun_declaration();
 
+  else if (match(TOKEN_CONST))
+    const_declaration();
+
   else if (match(TOKEN_VAR))
     var_declaration();
 
@@ -1065,6 +1469,7 @@ ParseRule rules[] = {
   [TOKEN_NUMBER]        = {number,    NULL,    PREC_NONE       },
   [TOKEN_AND]           = {NULL,      and_,    PREC_AND        },
   [TOKEN_CLASS]         = {NULL,      NULL,    PREC_NONE       },
+  [TOKEN_CONST]         = {NULL,      NULL,    PREC_NONE       },
   [TOKEN_ELSE]          = {NULL,      NULL,    PREC_NONE       },
   [TOKEN_FALSE]         = {literal,   NULL,    PREC_NONE       },
   [TOKEN_FOR]           = {NULL,      NULL,    PREC_NONE       },
@@ -1086,6 +1491,12 @@ ParseRule rules[] = {
 
 static ParseRule* get_rule(TokenType type) { return &rules[type]; }
 
+void mark_compiler_roots() {
+  for (Compiler* compiler = current; compiler != NULL; compiler = compiler->enclosing) {
+    mark_object((Obj*) compiler->function);
+  }
+}
+
 ObjFunction* compile(const char* source) {
   Compiler compiler;
 
@@ -1100,6 +1511,8 @@ ObjFunction* compile(const char* source) {
   }
 
   ObjFunction* func = end_compiler();
+  free_arena(&arena);
+
   return parser.had_error ? NULL : func;
 }
 
@@ -1107,3 +1520,4 @@ ObjFunction* compile(const char* source) {
 
 #undef DEPTH_UNITIALIZED
 #undef UNRESOLVED_LOCAL
+#undef SYMBOLS_MIN
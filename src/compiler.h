@@ -6,4 +6,7 @@
 
 ObjFunction* compile(const char* source);
 
+/** Mark the functions that are still being compiled as GC roots. */
+void mark_compiler_roots();
+
 #endif // __CLOX_COMPILER_H__
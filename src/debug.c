@@ -126,6 +126,20 @@ size_t disasm_instruction(Chunk* chunk, size_t offset) {
     case OP_NEGATE:
       return simple_instr("OP_NEGATE", offset);
 
+    // -- intrinsics --
+    case OP_SQRT:
+      return simple_instr("OP_SQRT", offset);
+    case OP_FLOOR:
+      return simple_instr("OP_FLOOR", offset);
+    case OP_ABS:
+      return simple_instr("OP_ABS", offset);
+    case OP_MIN:
+      return simple_instr("OP_MIN", offset);
+    case OP_MAX:
+      return simple_instr("OP_MAX", offset);
+    case OP_CLOCK:
+      return simple_instr("OP_CLOCK", offset);
+
     // -- statements --
     case OP_PRINT:
       return simple_instr("OP_PRINT", offset);
@@ -0,0 +1,1094 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "compiler.h"
+#include "gc.h"
+#include "heap_snapshot.h"
+#include "memory.h"
+#include "object.h"
+#include "parallel_mark.h"
+#include "slab.h"
+#include "vm.h"
+
+#ifdef DEBUG_LOG_GC
+#include "debug.h"
+#endif
+
+// while an incremental collection is marking, do another slice of
+// marking each time the (old-generation) heap grows by this much
+#define GC_SLICE_BYTES (256 * 1024)
+
+// if the heap outgrows `next_gc` by this factor before incremental
+// marking is done, the mutator is outpacing the collector, so stop
+// the world and finish the collection all at once
+#define GC_INCREMENTAL_LIMIT 2
+
+// how many bytes of objects each incremental slice traces (at least)
+// for every byte allocated since the last slice
+#define GC_MARK_RATE 2
+
+// after marking, dead objects are swept lazily: this many objects are
+// swept each time the heap grows...
+#define GC_SWEEP_BATCH 64
+
+// ...and this many at each minor collection (since allocating in the
+// nursery doesn't go through `reallocate`)
+#define GC_SWEEP_MINOR_BATCH 4096
+
+#define NURSERY_ALIGN(size) (((size) + 7) & ~((size_t) 7))
+
+// compaction empties out slabs that are less than this full
+#define GC_COMPACT_OCCUPANCY 0.5
+
+// ...but isn't worth doing until there are at least this many bytes
+// of slabs (unless it's been asked for after every collection)
+#define GC_COMPACT_MIN_BYTES (1024 * 1024)
+
+static void push_obj(ObjStack* stack, Obj* obj) {
+  if (stack->count == stack->cap) {
+    stack->cap = GROW_CAPACITY(stack->cap);
+    stack->items = realloc(stack->items, sizeof(Obj*) * stack->cap);
+    if (stack->items == NULL) exit(1);
+  }
+
+  stack->items[stack->count++] = obj;
+}
+
+static void free_obj_stack(ObjStack* stack) {
+  free(stack->items);
+  stack->items = NULL;
+  stack->count = 0;
+  stack->cap = 0;
+}
+
+// -- pause tracking
+//
+// Every stop-the-world pause (minor collections, incremental marking
+// slices, and full collections) is timed, so that pause percentiles
+// can be reported at exit.
+
+static struct {
+  size_t minor_count;
+  size_t major_count; // (incremental or not)
+  size_t slice_count;
+
+  size_t compact_count;
+  size_t compact_moved;    // objects moved
+  size_t compact_released; // bytes of slabs given back to the system
+
+  size_t  count;
+  size_t  cap;
+  double* pauses; // in ms
+} stats;
+
+static double now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void record_pause(double start) {
+  if (stats.count == stats.cap) {
+    stats.cap = GROW_CAPACITY(stats.cap);
+    stats.pauses = realloc(stats.pauses, sizeof(double) * stats.cap);
+    if (stats.pauses == NULL) exit(1);
+  }
+
+  stats.pauses[stats.count++] = now_ms() - start;
+}
+
+static int compare_doubles(const void* a, const void* b) {
+  double x = *(const double*) a;
+  double y = *(const double*) b;
+  return (x > y) - (x < y);
+}
+
+// nearest-rank percentile of a sorted array
+static double percentile(double* sorted, size_t count, double p) {
+  size_t rank = (size_t) (p / 100 * count + 0.5);
+  if (rank < 1) rank = 1;
+  if (rank > count) rank = count;
+  return sorted[rank - 1];
+}
+
+void print_gc_stats() {
+  fprintf(stderr, "gc: %zu minor, %zu major (%zu incremental slices)\n",
+          stats.minor_count, stats.major_count, stats.slice_count);
+
+  print_slab_stats();
+
+  if (stats.compact_count > 0) {
+    fprintf(stderr, "compaction: %zu runs, %zu objects moved, %.1f KB released\n",
+            stats.compact_count, stats.compact_moved, stats.compact_released / 1024.0);
+  }
+
+  if (stats.count == 0) return;
+
+  double* sorted = malloc(sizeof(double) * stats.count);
+  if (sorted == NULL) exit(1);
+  memcpy(sorted, stats.pauses, sizeof(double) * stats.count);
+  qsort(sorted, stats.count, sizeof(double), compare_doubles);
+
+  double total = 0;
+  for (size_t i = 0; i < stats.count; i++) total += sorted[i];
+
+  fprintf(stderr, "gc pauses (ms): n=%zu total=%.3f p50=%.3f p90=%.3f p99=%.3f max=%.3f\n",
+          stats.count, total,
+          percentile(sorted, stats.count, 50),
+          percentile(sorted, stats.count, 90),
+          percentile(sorted, stats.count, 99),
+          sorted[stats.count - 1]);
+
+  free(sorted);
+}
+
+// -- the nursery (young generation)
+//
+// New objects are bump-allocated out of a single contiguous block.
+// Most of them die young, so rather than tracing the whole heap, a
+// minor collection copies the few that are still reachable into the
+// old generation (promoting them), then resets the nursery in one go.
+//
+//     start                       top            end
+//     [str][closure][str][uv][str][ - - - - - - - ]
+//                                  free space
+//
+// The roots of a minor collection are the VM's own roots, plus any
+// old objects that might reference young ones. Rather than scanning
+// the old generation for those, the mutator records them as they're
+// created, using a write barrier (see WRITE_BARRIER).
+//
+// Objects are only ever moved at safepoints (see `gc_safepoint`),
+// so the C code between them can hold raw object pointers freely.
+
+void init_heap() {
+  vm.nursery.start = (uint8_t*) malloc(NURSERY_SIZE);
+  if (vm.nursery.start == NULL) exit(1);
+
+  vm.nursery.top = vm.nursery.start;
+  vm.nursery.end = vm.nursery.start + NURSERY_SIZE;
+}
+
+Obj* nursery_allocate(size_t size) {
+  size = NURSERY_ALIGN(size);
+
+#ifdef DEBUG_STRESS_GC
+  vm.minor_gc_pending = true;
+  vm.safepoint_requested = true;
+#endif
+
+  if ((size_t) (vm.nursery.end - vm.nursery.top) < size) {
+    vm.minor_gc_pending = true; // full, collect at the next safepoint
+    vm.safepoint_requested = true;
+    return NULL;
+  }
+
+  Obj* obj = (Obj*) vm.nursery.top;
+  vm.nursery.top += size;
+  return obj;
+}
+
+void track_old_object(Obj* obj) {
+  // it may be initialized to point at young objects without
+  // a write barrier, so treat it as a root until the next minor
+  // collection (which is never far off, since the nursery is full)
+  remember_object(obj);
+
+  // objects created during marking are allocated gray, since they
+  // may be initialized to point at objects that haven't been marked
+  if (vm.gc_state == GC_MARKING) {
+    set_marked(obj, true);
+    push_obj(&vm.gray, obj);
+  }
+}
+
+void remember_object(Obj* obj) {
+  if (is_remembered(obj)) return;
+
+  set_remembered(obj, true);
+  push_obj(&vm.remembered, obj);
+}
+
+void remember_entry(Table* tab, Value key, Value val) {
+  if ((IS_OBJ(key) && IS_YOUNG(AS_OBJ(key))) || (IS_OBJ(val) && IS_YOUNG(AS_OBJ(val)))) {
+    TableRefStack* refs = &vm.remembered_entries;
+    if (refs->count == refs->cap) {
+      refs->cap = GROW_CAPACITY(refs->cap);
+      refs->items = realloc(refs->items, sizeof(TableRef) * refs->cap);
+      if (refs->items == NULL) exit(1);
+    }
+
+    refs->items[refs->count++] = (TableRef) { .table = tab, .key = key };
+
+    // (the same entry is remembered each time it's set, so a loop that
+    // keeps setting a global whose name is young would grow this without
+    // bound if it never allocated enough to fill the nursery)
+    if (refs->count * sizeof(TableRef) >= NURSERY_SIZE) {
+      vm.minor_gc_pending = true;
+      vm.safepoint_requested = true;
+    }
+  }
+
+  if (vm.gc_state == GC_MARKING) { // (see WRITE_BARRIER)
+    mark_value(key);
+    mark_value(val);
+  }
+}
+
+void forget_entries(Table* tab) {
+  TableRefStack* refs = &vm.remembered_entries;
+
+  size_t count = 0;
+  for (size_t i = 0; i < refs->count; i++) {
+    if (refs->items[i].table != tab) refs->items[count++] = refs->items[i];
+  }
+  refs->count = count;
+}
+
+// Copy a young object into the old generation (if it hasn't been
+// already), and update the reference to point at the copy. The old
+// copy's `next` field is used as a forwarding pointer, since young
+// objects aren't linked into `vm.objects`.
+static void promote(Obj** slot) {
+  Obj* obj = *slot;
+  if (obj == NULL || !IS_YOUNG(obj)) return;
+
+  if (obj_next(obj) != NULL) { // already promoted
+    *slot = obj_next(obj);
+    return;
+  }
+
+  size_t size = object_size(obj);
+  Obj* copy = old_allocate(size);
+  Obj* next = obj_next(copy);
+  memcpy(copy, obj, size);
+  set_obj_next(copy, next);
+
+  // closed upvalues point at their own `closed` field
+  if (obj_type(obj) == OBJ_UPVALUE) {
+    ObjUpvalue* uv = (ObjUpvalue*) obj;
+    if (uv->location == &uv->closed) {
+      ((ObjUpvalue*) copy)->location = &((ObjUpvalue*) copy)->closed;
+    }
+  }
+
+  set_obj_next(obj, copy);
+
+  push_obj(&vm.promoted, copy); // its references may still point into the nursery
+  *slot = copy;
+
+  // while marking, promoted objects are gray, like any other object
+  // that's created in the old generation (see `track_old_object`)
+  if (vm.gc_state == GC_MARKING) mark_object(copy);
+}
+
+static inline void promote_value(Value* val) {
+  if (IS_OBJ(*val)) promote(&AS_OBJ(*val));
+}
+
+static void collect_nursery() {
+#ifdef DEBUG_LOG_GC
+  fprintf(stderr, "-- minor gc begin\n");
+  size_t before = vm.bytes_allocated;
+#endif
+
+  stats.minor_count++;
+
+  // (this is also part of finishing an incremental collection, which
+  // must still count as being in the GC once the nursery's done)
+  bool was_in_gc = vm.in_gc;
+  vm.in_gc = true;
+
+  // 1. promote everything directly reachable from the roots
+  for (Value* slot = vm.stack; slot < vm.stack_top; slot++) {
+    promote_value(slot);
+  }
+
+  for (int i = 0; i < vm.frame_count; i++) {
+    promote((Obj**) &vm.frames[i].closure);
+  }
+
+  promote((Obj**) &vm.open_upvalues);
+  for (ObjUpvalue* uv = vm.open_upvalues; uv != NULL; uv = uv->next) {
+    promote((Obj**) &uv->next);
+  }
+
+  // 2. ...and from old objects and table entries that may reference
+  //    young objects (the intern table is handled below)
+  for (size_t i = 0; i < vm.remembered.count; i++) {
+    Obj* obj = vm.remembered.items[i];
+    set_remembered(obj, false);
+    visit_references(obj, promote);
+  }
+
+  for (size_t i = 0; i < vm.remembered_entries.count; i++) {
+    TableRef* ref = &vm.remembered_entries.items[i];
+    if (ref->table == &vm.strings) continue;
+
+    Entry* entry = table_find_entry(ref->table, ref->key);
+    if (entry == NULL) continue; // deleted since
+
+    promote_value(&entry->value);
+
+    // (moving the key may move the entry, see `table_move_key`)
+    Value key = entry->key;
+    promote_value(&key);
+    if (IS_OBJ(key) && AS_OBJ(key) != AS_OBJ(entry->key)) {
+      table_move_key(ref->table, entry->key, key);
+    }
+  }
+
+  // 3. promote everything reachable from the promoted objects
+  while (vm.promoted.count > 0) {
+    Obj* obj = vm.promoted.items[--vm.promoted.count];
+    visit_references(obj, promote);
+  }
+
+  // 4. interned strings don't keep young strings alive (otherwise every
+  //    temporary string would be promoted), so drop any that weren't
+  for (size_t i = 0; i < vm.remembered_entries.count; i++) {
+    TableRef* ref = &vm.remembered_entries.items[i];
+    if (ref->table != &vm.strings || !IS_YOUNG(AS_OBJ(ref->key))) continue;
+
+    Entry* entry = table_find_entry(&vm.strings, ref->key);
+    if (entry == NULL) continue;
+
+    Obj* key = AS_OBJ(ref->key);
+    if (obj_next(key) != NULL) entry->key = OBJ_VAL(obj_next(key));
+    else                   table_delete(&vm.strings, ref->key);
+  }
+
+  // 5. free whatever the dead objects own, and reset the nursery
+  uint8_t* cursor = vm.nursery.start;
+  while (cursor < vm.nursery.top) {
+    Obj* obj = (Obj*) cursor;
+    cursor += NURSERY_ALIGN(object_size(obj));
+
+    if (obj_next(obj) == NULL) free_object_payload(obj);
+  }
+
+#ifdef DEBUG_STRESS_GC
+  // poison the nursery, so stale references are easier to spot
+  memset(vm.nursery.start, 0xAB, vm.nursery.top - vm.nursery.start);
+#endif
+
+  vm.nursery.top = vm.nursery.start;
+  vm.remembered.count = 0;
+  vm.remembered_entries.count = 0;
+  vm.minor_gc_pending = false;
+  vm.in_gc = was_in_gc;
+
+#ifdef DEBUG_LOG_GC
+  fprintf(stderr, "-- minor gc end\n");
+  fprintf(stderr, "   promoted %zu bytes\n", vm.bytes_allocated - before);
+#endif
+}
+
+// -- marking
+//
+// Marking an object colors it gray (reachable, but its own references
+// haven't been traced yet) by pushing it onto the gray stack. Tracing
+// then pops gray objects and marks everything they reference, which
+// turns them black. Once the gray stack is empty, anything left
+// unmarked (white) is unreachable.
+//
+// Only old objects are marked. Young objects are never freed by a
+// major collection, so instead of being traced, every one of them is
+// treated as a root (see `mark_nursery`).
+
+void mark_object(Obj* obj) {
+  if (obj == NULL || is_marked(obj) || IS_YOUNG(obj)) return;
+
+#ifdef DEBUG_LOG_GC
+  fprintf(stderr, "%p mark ", (void*) obj);
+  print_value(OBJ_VAL(obj));
+  fprintf(stderr, "\n");
+#endif
+
+  set_marked(obj, true);
+  push_obj(&vm.gray, obj);
+}
+
+void mark_value(Value val) {
+  if (IS_OBJ(val)) mark_object(AS_OBJ(val));
+}
+
+static void mark_slot(Obj** slot) {
+  mark_object(*slot);
+}
+
+static void mark_table(Table* tab) {
+  size_t cursor = 0;
+  for (Entry* entry; (entry = table_next(tab, &cursor)) != NULL;) {
+    mark_value(entry->key);
+    mark_value(entry->value);
+  }
+}
+
+// mark every old object that a young object references (whether
+// or not the young object itself is still reachable)
+static void mark_nursery() {
+  uint8_t* cursor = vm.nursery.start;
+  while (cursor < vm.nursery.top) {
+    Obj* obj = (Obj*) cursor;
+    cursor += NURSERY_ALIGN(object_size(obj));
+    visit_references(obj, mark_slot);
+  }
+}
+
+// roots that are written to without a write barrier, which have to
+// be marked again before an incremental collection can finish
+static void mark_unbarriered_roots() {
+  // values on the stack (locals and temporaries)
+  for (Value* slot = vm.stack; slot < vm.stack_top; slot++) {
+    mark_value(*slot);
+  }
+
+  // closures being executed (these are usually on the stack
+  // as well, but nothing guarantees that they are)
+  for (int i = 0; i < vm.frame_count; i++) {
+    mark_object((Obj*) vm.frames[i].closure);
+  }
+
+  // upvalues that haven't been closed yet
+  for (ObjUpvalue* uv = vm.open_upvalues; uv != NULL; uv = uv->next) {
+    mark_object((Obj*) uv);
+  }
+
+  // functions that are still being compiled
+  mark_compiler_roots();
+}
+
+static void mark_roots() {
+  mark_unbarriered_roots();
+
+  mark_table(&vm.globals);
+  mark_table(&vm.consts);
+  mark_table(&vm.declared);
+
+  // (the intern table is weak, see `finish_collection`)
+
+  mark_nursery();
+}
+
+static void blacken_object(Obj* obj) {
+#ifdef DEBUG_LOG_GC
+  fprintf(stderr, "%p blacken ", (void*) obj);
+  print_value(OBJ_VAL(obj));
+  fprintf(stderr, "\n");
+#endif
+
+  // mark everything a gray object references, turning it black
+  visit_references(obj, mark_slot);
+}
+
+static void trace_references() {
+  // (objects aren't logged as they're blackened when marking in parallel)
+  if (vm.gc_threads > 1) {
+    parallel_trace_references();
+    return;
+  }
+
+  while (vm.gray.count > 0) {
+    blacken_object(vm.gray.items[--vm.gray.count]);
+  }
+}
+
+// Trace gray objects until there are none left, or until `deadline`
+// (checking the time every so often, since it isn't free). However,
+// at least `min_bytes` worth of objects are traced regardless, so that
+// marking keeps up with allocation even if that means a longer pause.
+//
+// @return true if tracing finished
+static bool trace_references_until(double deadline, size_t min_bytes) {
+#ifdef DEBUG_STRESS_GC
+  int budget = 4; // keep slices tiny, to interleave them with the mutator
+#endif
+
+  size_t traced = 0;
+  while (vm.gray.count > 0) {
+    for (int i = 0; i < 64 && vm.gray.count > 0; i++) {
+      Obj* obj = vm.gray.items[--vm.gray.count];
+      traced += object_size(obj);
+      blacken_object(obj);
+    }
+
+#ifdef DEBUG_STRESS_GC
+    if (--budget == 0) break;
+#else
+    if (traced >= min_bytes && now_ms() >= deadline) break;
+#endif
+  }
+
+  return vm.gray.count == 0;
+}
+
+// -- sweeping
+
+// Drop remembered objects and entries that are about to be swept,
+// since the next minor collection would otherwise visit them.
+static void prune_remembered() {
+  size_t count = 0;
+  for (size_t i = 0; i < vm.remembered.count; i++) {
+    Obj* obj = vm.remembered.items[i];
+    if (is_marked(obj)) vm.remembered.items[count++] = obj;
+  }
+  vm.remembered.count = count;
+
+  count = 0;
+  for (size_t i = 0; i < vm.remembered_entries.count; i++) {
+    Value key = vm.remembered_entries.items[i].key;
+    if (!IS_OBJ(key) || IS_YOUNG(AS_OBJ(key)) || is_marked(AS_OBJ(key))) {
+      vm.remembered_entries.items[count++] = vm.remembered_entries.items[i];
+    }
+  }
+  vm.remembered_entries.count = count;
+}
+
+// -- sweeping
+//
+// Once marking is done, the mutator resumes right away, and dead objects
+// are freed a few at a time as it allocates. Sweeping detaches each size
+// class's list of objects, and then moves the survivors back one by one
+// (objects allocated in the meantime go straight onto the live lists,
+// so they're never swept by mistake).
+//
+//     objects[c]: [new]->[survivor]->[survivor]
+//     unswept[c]: [dead]->[survivor]->[dead]->[dead]-> ...
+//
+// Until an object's been swept, its mark bit is stale, so any sweep
+// that's in progress is finished before marking starts again.
+
+static void begin_sweep() {
+  for (int i = 0; i < SIZE_CLASS_COUNT; i++) {
+    vm.unswept[i] = vm.objects[i];
+    vm.objects[i] = NULL;
+  }
+
+  vm.sweep_class = 0;
+  vm.gc_state = GC_SWEEPING;
+
+  // the heap hasn't actually shrunk yet, so until it has, hold off
+  // on scheduling the next collection based on its size
+  schedule_next_gc();
+}
+
+static void end_sweep() {
+  vm.gc_state = GC_IDLE;
+  schedule_next_gc();
+
+  // now that the garbage is gone, see how much of the slabs it left empty
+  if (vm.gc_compact >= 0) {
+    bool worth_it = slab_reserved_bytes() >= GC_COMPACT_MIN_BYTES &&
+                    slab_fragmentation() * 100 >= vm.gc_compact;
+
+    if (vm.gc_compact == 0 || worth_it) {
+      vm.compact_pending = true;
+      vm.safepoint_requested = true;
+    }
+  }
+
+#ifdef DEBUG_LOG_GC
+  fprintf(stderr, "-- sweep end, heap is %zu bytes, next gc at %zu\n",
+          vm.bytes_allocated, vm.next_gc);
+#endif
+}
+
+// sweep (up to) `count` objects of one size class
+//
+// @return how many objects were swept
+static size_t sweep_class(int class, size_t count) {
+  size_t swept = 0;
+
+  while (swept < count && vm.unswept[class] != NULL) {
+    Obj* obj = vm.unswept[class];
+    vm.unswept[class] = obj_next(obj);
+    swept++;
+
+    if (is_marked(obj)) { // survivor, reset for the next collection
+      set_marked(obj, false);
+      set_obj_next(obj, vm.objects[class]);
+      vm.objects[class] = obj;
+    } else {
+      free_object(obj);
+    }
+  }
+
+  return swept;
+}
+
+// sweep (up to) `count` objects, a size class at a time
+static void sweep_some(size_t count) {
+  while (vm.sweep_class < SIZE_CLASS_COUNT) {
+    size_t swept = sweep_class(vm.sweep_class, count);
+    if (swept == count) return;
+
+    count -= swept;
+    vm.sweep_class++;
+  }
+
+  end_sweep();
+}
+
+static void finish_sweep() {
+  sweep_some(SIZE_MAX);
+}
+
+Obj* old_allocate(size_t size) {
+  int class = SIZE_CLASS(size);
+
+  // sweep this object's own size class first, so that the memory
+  // of dead objects the same size is free to be reused right away
+  if (vm.gc_state == GC_SWEEPING && !vm.in_gc) {
+    sweep_class(class, GC_SWEEP_BATCH);
+  }
+
+  Obj* obj = (Obj*) reallocate(NULL, 0, size);
+  obj->header = (uint64_t) (uintptr_t) vm.objects[class];
+  vm.objects[class] = obj;
+
+  return obj;
+}
+
+// -- compaction
+//
+// Freed blocks are reused by objects of the same size class, but if the
+// heap shrinks (or its mix of sizes shifts), slabs can be left mostly
+// empty, yet can't be given back to the system while even one block in
+// them is in use. Compaction moves every object out of the sparsest
+// slabs, into the free blocks of fuller ones, and then releases the
+// slabs that are left empty.
+//
+//     before:  [a][ ][ ][b][ ]   [c][d][ ][e][f]
+//     after:   [ ][ ][ ][ ][ ]   [c][d][a][e][f] [b] ...
+//              released
+//
+// Moved objects leave a forwarding pointer behind (in `next`, like
+// promotion), then every reference in the heap and the roots is updated.
+// The things old objects own (strings' characters, and closures' upvalue
+// arrays) are moved along with them. Functions'
+// chunks aren't, since a running frame's `ip` points into its code (and
+// blocks bigger than a slab's largest size class are never moved).
+//
+// It only runs at a safepoint, between collections (so that every
+// object on `vm.objects` is alive, and none of them are marked).
+
+static ObjStack evacuated; // (while compacting) the objects that were moved
+
+static bool is_evacuating(Obj* obj) {
+  return obj != NULL && !IS_YOUNG(obj) && IS_SLAB_SIZE(object_size(obj)) &&
+         slab_is_evacuating(obj);
+}
+
+static void forward(Obj** slot) {
+  Obj* obj = *slot;
+  if (is_evacuating(obj) && is_marked(obj)) *slot = obj_next(obj);
+}
+
+static inline void forward_value(Value* val) {
+  if (IS_OBJ(*val)) forward(&AS_OBJ(*val));
+}
+
+// move a block that an object owns, if it's in a slab that's being emptied
+static void* relocate(void* ptr, size_t len) {
+  if (ptr == NULL || !IS_SLAB_SIZE(len) || !slab_is_evacuating(ptr)) return ptr;
+
+  void* copy = slab_allocate(len);
+  memcpy(copy, ptr, len);
+  slab_free(ptr, len);
+  return copy;
+}
+
+// (a table's buckets are never small enough to be in a slab)
+static void forward_table(Table* tab) {
+  bool moved_keys = false;
+
+  size_t cursor = 0;
+  for (Entry* entry; (entry = table_next(tab, &cursor)) != NULL;) {
+    Obj* key = IS_OBJ(entry->key) ? AS_OBJ(entry->key) : NULL;
+    forward_value(&entry->key);
+    forward_value(&entry->value);
+
+    // (strings keep their hash when they move, but other objects don't)
+    if (key != NULL && AS_OBJ(entry->key) != key && !IS_STRING(entry->key)) {
+      moved_keys = true;
+    }
+  }
+
+  if (moved_keys) table_rehash(tab);
+}
+
+static void update_object(Obj* obj) {
+  visit_references(obj, forward);
+
+  switch (obj_type(obj)) {
+    case OBJ_CLOSURE: {
+      ObjClosure* closure = (ObjClosure*) obj;
+      closure->upvalues = relocate(closure->upvalues, sizeof(ObjUpvalue*) * closure->upvalue_count);
+      break;
+    }
+    case OBJ_STRING: {
+      ObjString* str = (ObjString*) obj;
+      str->chars = relocate(str->chars, str->len + 1);
+      break;
+    }
+    default:
+      break;
+  }
+}
+
+static void compact_heap() {
+  vm.compact_pending = false;
+
+  // (young objects aren't moved by compaction, and until the nursery's
+  // been collected, dead ones may reference objects that have been freed)
+  if (vm.nursery.top > vm.nursery.start) collect_nursery();
+
+  size_t slabs = slab_begin_evacuation(GC_COMPACT_OCCUPANCY);
+  if (slabs == 0) {
+    slab_end_evacuation();
+    return;
+  }
+
+#ifdef DEBUG_LOG_GC
+  fprintf(stderr, "-- compaction begin (%zu slabs)\n", slabs);
+#endif
+
+  // 1. move every object that's in one of those slabs
+  for (int i = 0; i < SIZE_CLASS_COUNT; i++) {
+    Obj* prev = NULL;
+    for (Obj* obj = vm.objects[i]; obj != NULL; prev = obj, obj = obj_next(obj)) {
+      if (!is_evacuating(obj)) continue;
+
+      size_t size = object_size(obj);
+      Obj* copy = (Obj*) slab_allocate(size);
+      memcpy(copy, obj, size);
+
+      // closed upvalues point at their own `closed` field
+      if (obj_type(obj) == OBJ_UPVALUE) {
+        ObjUpvalue* uv = (ObjUpvalue*) obj;
+        if (uv->location == &uv->closed) {
+          ((ObjUpvalue*) copy)->location = &((ObjUpvalue*) copy)->closed;
+        }
+      }
+
+      if (prev == NULL) vm.objects[i] = copy;
+      else              set_obj_next(prev, copy);
+
+      set_marked(obj, true); // (moved)
+      set_obj_next(obj, copy);
+      push_obj(&evacuated, obj);
+      obj = copy;
+    }
+  }
+
+  // 2. update every reference to them
+  for (int i = 0; i < SIZE_CLASS_COUNT; i++) {
+    for (Obj* obj = vm.objects[i]; obj != NULL; obj = obj_next(obj)) update_object(obj);
+  }
+
+  for (Value* slot = vm.stack; slot < vm.stack_top; slot++) {
+    forward_value(slot);
+  }
+
+  for (int i = 0; i < vm.frame_count; i++) {
+    forward((Obj**) &vm.frames[i].closure);
+  }
+
+  forward((Obj**) &vm.open_upvalues);
+  for (ObjUpvalue* uv = vm.open_upvalues; uv != NULL; uv = uv->next) {
+    forward((Obj**) &uv->next);
+  }
+
+  forward_table(&vm.globals);
+  forward_table(&vm.consts);
+  forward_table(&vm.declared);
+  forward_table(&vm.strings);
+
+  // 3. free the originals, and whichever slabs are now empty
+  for (size_t i = 0; i < evacuated.count; i++) {
+    Obj* obj = evacuated.items[i];
+    slab_free(obj, object_size(obj));
+  }
+
+  size_t released = slab_end_evacuation();
+
+  // (the tables aren't in the slabs, but may as well give back whatever
+  // room they aren't using too)
+  table_compact(&vm.globals);
+  table_compact(&vm.strings);
+
+#ifdef DEBUG_LOG_GC
+  fprintf(stderr, "-- compaction end, moved %zu objects, released %zu bytes\n",
+          evacuated.count, released);
+#endif
+
+  stats.compact_count++;
+  stats.compact_moved += evacuated.count;
+  stats.compact_released += released;
+  free_obj_stack(&evacuated);
+}
+
+// -- collection cycles
+
+// (once tracing is done)
+static void finish_collection() {
+  // drop interned strings that nothing else references (before they're
+  // swept, so that they can't be looked up again)
+  table_remove_unmarked(&vm.strings);
+
+  prune_remembered();
+  begin_sweep();
+}
+
+void collect_garbage() {
+#ifdef DEBUG_LOG_GC
+  fprintf(stderr, "-- gc begin\n");
+#endif
+
+  double start = now_ms();
+  vm.in_gc = true;
+
+  // if an incremental collection is in progress, everything it's
+  // marked so far is still valid, so just carry on from there
+  if (vm.gc_state == GC_SWEEPING) finish_sweep();
+  if (vm.gc_state == GC_IDLE) stats.major_count++;
+
+  mark_roots();
+  trace_references();
+  finish_collection();
+
+  vm.major_gc_pending = false;
+  vm.in_gc = false;
+  record_pause(start);
+
+#ifdef DEBUG_LOG_GC
+  fprintf(stderr, "-- gc end (sweeping lazily)\n");
+#endif
+}
+
+// An incremental collection marks the roots in one pause, then traces
+// the heap a slice at a time, while the mutator runs in between. The
+// write barrier keeps the mutator from hiding a white object inside a
+// black one, and roots without a barrier are marked again at the end.
+static void begin_incremental() {
+#ifdef DEBUG_LOG_GC
+  fprintf(stderr, "-- gc begin (incremental)\n");
+#endif
+
+  if (vm.gc_state == GC_SWEEPING) finish_sweep();
+
+  stats.major_count++;
+  vm.major_gc_pending = false;
+  vm.gc_state = GC_MARKING;
+  vm.gc_slice_start = vm.bytes_allocated;
+
+  mark_roots();
+}
+
+// (at a safepoint, once the gray stack has been emptied)
+static void finish_incremental() {
+  // young objects aren't marked, so promote any that are still alive
+  // (promoted objects are gray, and so are traced below)
+  collect_nursery();
+
+  mark_unbarriered_roots();
+  trace_references();
+  finish_collection();
+
+#ifdef DEBUG_LOG_GC
+  fprintf(stderr, "-- gc end (incremental, sweeping lazily)\n");
+#endif
+}
+
+void schedule_next_gc() {
+  size_t live = vm.bytes_allocated;
+
+  vm.next_gc = (size_t) (live * vm.gc_grow_factor);
+  if (vm.next_gc < vm.gc_heap_min) vm.next_gc = vm.gc_heap_min;
+
+  // under a heap limit, collect once half of whatever room is left has
+  // been used up, so that collections get more frequent (rather than
+  // the heap simply hitting the limit) as it fills up
+  if (vm.max_heap > 0) {
+    size_t headroom = vm.max_heap > live ? (vm.max_heap - live) / 2 : 0;
+    if (vm.next_gc > live + headroom) vm.next_gc = live + headroom;
+  }
+}
+
+void enforce_heap_limit(size_t growth) {
+  if (vm.in_gc) return; // (a collection can't be started during another)
+
+  collect_garbage();
+  finish_sweep(); // (so that the garbage is actually freed)
+
+  // the intern table was pruned during the collection, but may still be
+  // holding on to buckets, as may the globals (rebuilding them allocates,
+  // which mustn't start another collection)
+  vm.in_gc = true;
+  table_compact(&vm.globals);
+  table_compact(&vm.strings);
+  vm.in_gc = false;
+
+  if (vm.bytes_allocated + growth <= vm.max_heap) return;
+
+#ifdef DEBUG_LOG_GC
+  fprintf(stderr, "-- heap limit: %zu + %zu bytes is over %zu\n",
+          vm.bytes_allocated, growth, vm.max_heap);
+#endif
+
+  if (vm.out_of_memory != NULL) out_of_memory();
+}
+
+void gc_check_heap() {
+  if (vm.gc_state == GC_SWEEPING) sweep_some(GC_SWEEP_BATCH);
+
+#ifdef DEBUG_STRESS_GC
+  if (vm.gc_max_pause == 0) {
+    collect_garbage();
+    return;
+  }
+
+  if (vm.gc_state != GC_MARKING) vm.major_gc_pending = true;
+  vm.safepoint_requested = true;
+#else
+  if (vm.bytes_allocated <= vm.next_gc) return;
+
+  if (vm.gc_max_pause == 0) { // stop-the-world
+    collect_garbage();
+    return;
+  }
+
+  if (vm.gc_state != GC_MARKING) {
+    vm.major_gc_pending = true;
+    vm.safepoint_requested = true;
+    return;
+  }
+
+  if (vm.bytes_allocated > vm.next_gc * GC_INCREMENTAL_LIMIT) {
+    collect_garbage();
+  } else if (vm.bytes_allocated >= vm.next_gc_slice) {
+    vm.safepoint_requested = true;
+  }
+#endif
+}
+
+void gc_safepoint() {
+  // (one might have been asked for by a signal, see `request_heap_snapshot`)
+  take_requested_heap_snapshot();
+
+  double start = now_ms();
+  vm.in_gc = true;
+  vm.safepoint_requested = false;
+
+  if (vm.minor_gc_pending) {
+    collect_nursery();
+    if (vm.gc_state == GC_SWEEPING) sweep_some(GC_SWEEP_MINOR_BATCH);
+  }
+
+  if (vm.major_gc_pending && vm.gc_state != GC_MARKING) begin_incremental();
+
+  if (vm.gc_state == GC_MARKING) {
+    stats.slice_count++;
+
+    // pay back whatever was allocated since the last slice
+    size_t debt = vm.bytes_allocated - vm.gc_slice_start;
+    if (vm.bytes_allocated < vm.gc_slice_start) debt = 0;
+
+    if (trace_references_until(start + vm.gc_max_pause, debt * GC_MARK_RATE)) {
+      finish_incremental();
+    } else {
+      vm.gc_slice_start = vm.bytes_allocated;
+      vm.next_gc_slice = vm.bytes_allocated + GC_SLICE_BYTES;
+    }
+
+#ifdef DEBUG_STRESS_GC
+    vm.safepoint_requested = true;
+#endif
+  }
+
+  // (if another collection's already marking, this waits until it's done)
+  if (vm.compact_pending && vm.gc_state != GC_MARKING) {
+    if (vm.gc_state == GC_SWEEPING) finish_sweep();
+    compact_heap();
+  }
+
+  vm.in_gc = false;
+  record_pause(start);
+}
+
+void walk_heap(void (*visit)(Obj* obj)) {
+  for (int i = 0; i < SIZE_CLASS_COUNT; i++) {
+    for (Obj* obj = vm.objects[i]; obj != NULL; obj = obj_next(obj)) visit(obj);
+
+    // (anything that hasn't been swept yet is dead unless it was marked)
+    for (Obj* obj = vm.unswept[i]; obj != NULL; obj = obj_next(obj)) {
+      if (is_marked(obj)) visit(obj);
+    }
+  }
+
+  uint8_t* cursor = vm.nursery.start;
+  while (cursor < vm.nursery.top) {
+    Obj* obj = (Obj*) cursor;
+    cursor += NURSERY_ALIGN(object_size(obj));
+    visit(obj);
+  }
+}
+
+void free_heap() {
+  stop_mark_workers();
+
+  Obj* obj;
+
+  for (int i = 0; i < SIZE_CLASS_COUNT; i++) {
+    Obj* lists[] = { vm.objects[i], vm.unswept[i] };
+
+    for (int j = 0; j < 2; j++) {
+      obj = lists[j];
+      while (obj != NULL) {
+        Obj* next = obj_next(obj);
+        free_object(obj);
+        obj = next;
+      }
+    }
+
+    vm.objects[i] = NULL;
+    vm.unswept[i] = NULL;
+  }
+
+  uint8_t* cursor = vm.nursery.start;
+  while (cursor < vm.nursery.top) {
+    obj = (Obj*) cursor;
+    cursor += NURSERY_ALIGN(object_size(obj));
+    free_object_payload(obj);
+  }
+
+  free(vm.nursery.start);
+  vm.nursery.start = vm.nursery.top = vm.nursery.end = NULL;
+
+  free_obj_stack(&vm.gray);
+  free_obj_stack(&vm.promoted);
+  free_obj_stack(&vm.remembered);
+
+  free(vm.remembered_entries.items);
+  vm.remembered_entries.items = NULL;
+  vm.remembered_entries.count = 0;
+  vm.remembered_entries.cap = 0;
+
+  free(stats.pauses);
+  memset(&stats, 0, sizeof(stats));
+
+  free_slabs();
+}
+
+// ---
+
+#undef GC_SLICE_BYTES
+#undef GC_INCREMENTAL_LIMIT
+#undef GC_MARK_RATE
+#undef GC_SWEEP_BATCH
+#undef GC_SWEEP_MINOR_BATCH
+#undef NURSERY_ALIGN
+#undef GC_COMPACT_OCCUPANCY
+#undef GC_COMPACT_MIN_BYTES
@@ -0,0 +1,169 @@
+#ifndef __CLOX_GC_H__
+#define __CLOX_GC_H__
+
+#include "common.h"
+#include "value.h"
+
+// don't bother collecting garbage until the heap reaches this size
+// (by default, see `vm.gc_heap_min`)
+#define GC_HEAP_MIN (1024 * 1024)
+
+// after each collection, the next one is scheduled once the heap has
+// grown by this factor over whatever survived (by default, see
+// `vm.gc_grow_factor`)
+#define GC_HEAP_GROW_FACTOR 2.0
+
+// with `--compact`, compact the heap once this percentage of slab
+// memory is unused (see `vm.gc_compact`)
+#define GC_COMPACT_DEFAULT 50
+
+// size of the young generation (see `nursery_allocate`)
+#define NURSERY_SIZE (512 * 1024)
+
+// Old objects are kept on a separate list for each size class, so that
+// sweeping can free objects of the size that's about to be allocated.
+// Classes are 16 bytes apart, and anything bigger goes in the last one.
+#define SIZE_CLASS_COUNT 8
+#define SIZE_CLASS(size) \
+  ((size) > 16 * SIZE_CLASS_COUNT ? SIZE_CLASS_COUNT - 1 : ((size) - 1) / 16)
+
+// (these expect vm.h to have been included)
+#define IS_YOUNG(obj) \
+  ((uint8_t*) (obj) >= vm.nursery.start && (uint8_t*) (obj) < vm.nursery.end)
+
+// Call after storing `val` into object `owner` with anything other
+// than the usual constructors. Old objects that now reference young
+// ones are remembered (so minor collections can treat them as roots),
+// and while an incremental collection is marking, anything stored is
+// shaded gray (so it can't be missed by having been stored into an
+// object that has already been traced).
+#define WRITE_BARRIER(owner, val) \
+  do { \
+    if (IS_OBJ(val)) { \
+      if (IS_YOUNG(AS_OBJ(val))) { \
+        if (!IS_YOUNG(owner)) remember_object((Obj*) (owner)); \
+      } else if (vm.gc_state == GC_MARKING) { \
+        mark_object(AS_OBJ(val)); \
+      } \
+    } \
+  } while (0)
+
+typedef struct Table Table;
+
+// the young generation (see `nursery_allocate`)
+typedef struct {
+  uint8_t* start;
+  uint8_t* top; // next free byte
+  uint8_t* end;
+} Nursery;
+
+// a table entry that may reference a young object
+typedef struct {
+  Table* table;
+  Value  key;
+} TableRef;
+
+// the GC's worklists (these are grown with the system allocator, so
+// that growing them can't recursively kick off another collection)
+typedef struct {
+  size_t count;
+  size_t cap;
+  Obj**  items;
+} ObjStack;
+
+typedef struct {
+  size_t    count;
+  size_t    cap;
+  TableRef* items;
+} TableRefStack;
+
+typedef enum {
+  GC_IDLE,
+  GC_MARKING,  // an incremental collection is in progress
+  GC_SWEEPING, // marking is done, and dead objects are being freed lazily
+} GCState;
+
+/** Allocate the nursery (must be called before any objects are created). */
+void init_heap();
+
+/** Free every object, along with the GC's own storage. */
+void free_heap();
+
+/**
+ * Bump-allocate a young object.
+ *
+ * @return NULL if the nursery is full (a minor collection will happen at
+ *         the next safepoint, and the object should be allocated in the
+ *         old generation instead)
+ */
+Obj* nursery_allocate(size_t size);
+
+/**
+ * Allocate an object in the old generation (its header is left for
+ * the caller to initialize, apart from `next`).
+ */
+Obj* old_allocate(size_t size);
+
+/** Register an object that was just allocated in the old generation. */
+void track_old_object(Obj* obj);
+
+void remember_object(Obj* obj);
+
+/** Write barrier for table entries (see WRITE_BARRIER). */
+void remember_entry(Table* tab, Value key, Value val);
+
+/** Drop any of a table's entries from the remembered set (as it's freed). */
+void forget_entries(Table* tab);
+
+void mark_object(Obj* obj);
+
+void mark_value(Value val);
+
+/**
+ * Called by `reallocate` whenever the heap grows, to decide whether
+ * it's time to collect (or to do more incremental work).
+ */
+void gc_check_heap();
+
+/**
+ * Schedule the next collection (`vm.next_gc`) based on how big the heap
+ * is now, the growth tunables, and how close it is to `vm.max_heap`.
+ */
+void schedule_next_gc();
+
+/**
+ * Called by `reallocate` when growing the heap by `growth` bytes would
+ * take it past `vm.max_heap`. Everything that can be collected is, and
+ * if there's still no room, the running script is stopped with a
+ * runtime error (see `out_of_memory`). While there's no script to stop
+ * (e.g. while compiling), the limit is allowed to be exceeded.
+ */
+void enforce_heap_limit(size_t growth);
+
+/**
+ * Do any pending GC work (minor collections, incremental marking, and
+ * compaction).
+ * Objects may be moved, so this is only safe to call from a safepoint,
+ * where no raw object pointers are held outside of the VM's roots.
+ */
+void gc_safepoint();
+
+/**
+ * Mark every object that's reachable from the VM's roots, all at once
+ * (finishing any incremental collection that's in progress). Whatever
+ * isn't reachable is then freed lazily, as the mutator allocates.
+ * Nothing is moved, so this is safe to call at any time.
+ */
+void collect_garbage();
+
+/**
+ * Call `visit` with every object that may still be alive: old objects
+ * that survived the last collection (or were allocated since), and every
+ * young object (whether or not it's still reachable).
+ */
+void walk_heap(void (*visit)(Obj* obj));
+
+/** Print the number of collections and their pause time percentiles. */
+void print_gc_stats();
+
+#endif // __CLOX_GC_H__
@@ -0,0 +1,245 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "heap_profile.h"
+#include "object.h"
+#include "vm.h"
+
+// call stacks longer than this (as text) are cut short
+#define STACK_KEY_MAX 4096
+
+// how many sites to list in each part of the summary
+#define TOP_SITES 10
+
+#define SITE_MAP_MAX_LOAD 0.75
+
+// Samples are kept in plain malloc'd memory, rather than the Lox heap,
+// so that profiling doesn't change what it's measuring (or trigger
+// collections from the middle of an allocation).
+typedef struct {
+  char*    key;   // (NULL if the slot's empty)
+  uint32_t hash;
+  double   bytes; // estimated total, from the samples
+  double   count; // estimated number of objects
+} Site;
+
+typedef struct {
+  Site*  sites;
+  size_t len;
+  size_t cap;
+} SiteMap;
+
+static SiteMap stacks; // by whole call stack, e.g. "<script>:3;outer:7"
+static SiteMap lines;  // by the line that allocated, e.g. "outer:7"
+
+static size_t samples = 0;
+static double until_sample = 0; // bytes left until the next sample
+static uint64_t rng_state = 0x9e3779b97f4a7c15ULL;
+
+// xorshift64*, uniform in (0, 1]
+static double next_random() {
+  rng_state ^= rng_state >> 12;
+  rng_state ^= rng_state << 25;
+  rng_state ^= rng_state >> 27;
+  uint64_t n = (rng_state * 0x2545f4914f6cdd1dULL) >> 11; // 53 bits
+  return (double) (n + 1) / (double) (1ULL << 53);
+}
+
+// Gaps between samples are exponentially distributed (as if every byte
+// had the same small chance of being sampled), so that allocation
+// patterns that repeat with a fixed period can't line up with the
+// sampling and skew the profile.
+static double next_interval() {
+  return -log(next_random()) * (double) vm.heap_sample;
+}
+
+static uint32_t hash_key(const char* key, size_t len) {
+  uint32_t hash = 2166136261u; // FNV-1a
+  for (size_t i = 0; i < len; i++) {
+    hash ^= (uint8_t) key[i];
+    hash *= 16777619;
+  }
+  return hash;
+}
+
+static Site* find_slot(Site* sites, size_t cap, const char* key, size_t len, uint32_t hash) {
+  size_t index = hash & (cap - 1);
+  for (;;) {
+    Site* site = &sites[index];
+    if (site->key == NULL) return site;
+    if (site->hash == hash && strncmp(site->key, key, len) == 0 && site->key[len] == '\0') {
+      return site;
+    }
+
+    index = (index + 1) & (cap - 1);
+  }
+}
+
+static void grow_site_map(SiteMap* map) {
+  size_t cap = map->cap < 64 ? 64 : map->cap * 2;
+  Site* sites = calloc(cap, sizeof(Site));
+  if (sites == NULL) exit(1);
+
+  for (size_t i = 0; i < map->cap; i++) {
+    Site* site = &map->sites[i];
+    if (site->key == NULL) continue;
+    *find_slot(sites, cap, site->key, strlen(site->key), site->hash) = *site;
+  }
+
+  free(map->sites);
+  map->sites = sites;
+  map->cap = cap;
+}
+
+static void charge_site(SiteMap* map, const char* key, size_t len, double bytes, double count) {
+  if (map->len + 1 > map->cap * SITE_MAP_MAX_LOAD) grow_site_map(map);
+
+  uint32_t hash = hash_key(key, len);
+  Site* site = find_slot(map->sites, map->cap, key, len, hash);
+  if (site->key == NULL) {
+    site->key = strndup(key, len);
+    if (site->key == NULL) exit(1);
+    site->hash = hash;
+    map->len++;
+  }
+
+  site->bytes += bytes;
+  site->count += count;
+}
+
+static int frame_line(StackFrame* frame) {
+  Chunk* chunk = &frame->closure->function->chunk;
+
+  // (the ip has already moved past the instruction that's running)
+  size_t offset = frame->ip > chunk->code ? frame->ip - chunk->code - 1 : 0;
+  return get_nth_rle_array(&chunk->lines, offset);
+}
+
+// Write the current call stack to `key`, outermost frame first, and
+// return its length (`leaf` is set to where the innermost frame starts).
+static size_t describe_stack(char* key, size_t* leaf) {
+  *leaf = 0; // (even if the outermost frame gets cut short)
+
+  // objects created before the script starts running (interned names,
+  // constants, and functions) are the compiler's
+  if (vm.frame_count == 0) {
+    return (size_t) snprintf(key, STACK_KEY_MAX, "<compile>");
+  }
+
+  size_t len = 0;
+  for (int i = 0; i < vm.frame_count; i++) {
+    StackFrame* frame = &vm.frames[i];
+    ObjString* name = frame->closure->function->name;
+
+    int n = snprintf(key + len, STACK_KEY_MAX - len, "%s%s:%d", i == 0 ? "" : ";",
+                     name == NULL ? "<script>" : name->chars, frame_line(frame));
+    if (n < 0 || (size_t) n >= STACK_KEY_MAX - len) break; // (cut short)
+
+    *leaf = i == 0 ? 0 : len + 1;
+    len += n;
+  }
+
+  return len;
+}
+
+void profile_allocation(size_t size, size_t count) {
+  if (until_sample == 0) until_sample = next_interval(); // (first time)
+
+  until_sample -= (double) size;
+  if (until_sample > 0) return;
+
+  // a big allocation can cover more than one sampling interval
+  size_t hits = 0;
+  while (until_sample <= 0) {
+    until_sample += next_interval();
+    hits++;
+  }
+  samples += hits;
+
+  double bytes = (double) hits * (double) vm.heap_sample;
+  double objects = (double) count * bytes / (double) size;
+
+  static char key[STACK_KEY_MAX];
+  size_t leaf;
+  size_t len = describe_stack(key, &leaf);
+
+  charge_site(&stacks, key, len, bytes, objects);
+  charge_site(&lines, key + leaf, len - leaf, bytes, objects);
+}
+
+static int by_bytes(const void* a, const void* b) {
+  double diff = (*(Site**) b)->bytes - (*(Site**) a)->bytes;
+  return (diff > 0) - (diff < 0);
+}
+
+static int by_count(const void* a, const void* b) {
+  double diff = (*(Site**) b)->count - (*(Site**) a)->count;
+  return (diff > 0) - (diff < 0);
+}
+
+void write_heap_profile(const char* path) {
+  FILE* f = fopen(path, "w");
+  if (f == NULL) {
+    fprintf(stderr, "could not write heap profile to \"%s\".\n", path);
+    return;
+  }
+
+  double total = 0;
+  for (size_t i = 0; i < stacks.cap; i++) {
+    Site* site = &stacks.sites[i];
+    if (site->key == NULL) continue;
+
+    fprintf(f, "%s %.0f\n", site->key, site->bytes);
+    total += site->bytes;
+  }
+  fclose(f);
+
+  fprintf(stderr, "heap profile: %zu samples (one every ~%zu bytes), ~%.1f KB allocated, written to %s\n",
+          samples, vm.heap_sample, total / 1024.0, path);
+  if (lines.len == 0) return;
+
+  Site** sorted = malloc(sizeof(Site*) * lines.len);
+  if (sorted == NULL) exit(1);
+
+  size_t len = 0;
+  for (size_t i = 0; i < lines.cap; i++) {
+    if (lines.sites[i].key != NULL) sorted[len++] = &lines.sites[i];
+  }
+
+  size_t top = len < TOP_SITES ? len : TOP_SITES;
+
+  fprintf(stderr, "  top sites by bytes:\n");
+  qsort(sorted, len, sizeof(Site*), by_bytes);
+  for (size_t i = 0; i < top; i++) {
+    fprintf(stderr, "    %10.1f KB %5.1f%%  %s\n", sorted[i]->bytes / 1024.0,
+            100.0 * sorted[i]->bytes / total, sorted[i]->key);
+  }
+
+  fprintf(stderr, "  top sites by count:\n");
+  qsort(sorted, len, sizeof(Site*), by_count);
+  for (size_t i = 0; i < top; i++) {
+    fprintf(stderr, "    %10.0f objs   %s\n", sorted[i]->count, sorted[i]->key);
+  }
+
+  free(sorted);
+}
+
+static void free_site_map(SiteMap* map) {
+  for (size_t i = 0; i < map->cap; i++) free(map->sites[i].key);
+  free(map->sites);
+  *map = (SiteMap) {0};
+}
+
+void free_heap_profile() {
+  free_site_map(&stacks);
+  free_site_map(&lines);
+  samples = 0;
+  until_sample = 0;
+}
+
+// ---
+
+#undef STACK_KEY_MAX
+#undef TOP_SITES
+#undef SITE_MAP_MAX_LOAD
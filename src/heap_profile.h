@@ -0,0 +1,31 @@
+#ifndef __CLOX_HEAP_PROFILE_H__
+#define __CLOX_HEAP_PROFILE_H__
+
+#include "common.h"
+
+// default for `vm.heap_sample` (when profiling is turned on)
+#define HEAP_SAMPLE_DEFAULT (4 * 1024)
+
+/**
+ * Count `size` freshly-allocated bytes (making up `count` objects)
+ * towards the heap profile. Allocations are sampled at random, about
+ * once every `vm.heap_sample` bytes, and each sample is charged to the
+ * Lox call stack (function and line of each frame) that made it, and
+ * scaled up to stand in for all the bytes in between.
+ *
+ * Must only be called when profiling (`vm.heap_sample` > 0).
+ */
+void profile_allocation(size_t size, size_t count);
+
+/**
+ * Write the profile to `path` in folded-stack format (one line per call
+ * stack, frames separated by `;`, then the estimated bytes allocated),
+ * which flamegraph.pl and pprof-style tools read directly, and print a
+ * summary of the top allocation sites by bytes and by count to stderr.
+ */
+void write_heap_profile(const char* path);
+
+/** Free the profile's samples. */
+void free_heap_profile();
+
+#endif // __CLOX_HEAP_PROFILE_H__
@@ -0,0 +1,628 @@
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "gc.h"
+#include "heap_snapshot.h"
+#include "memory.h"
+#include "natives.h"
+#include "object.h"
+#include "vm.h"
+
+#define SNAPSHOT_MAGIC   "CLOXHEAP"
+#define SNAPSHOT_VERSION 1
+
+// labels (string contents, function names) are cut short at this length
+#define LABEL_MAX 48
+
+// how many of the biggest retainers to list
+#define TOP_RETAINERS 20
+
+#define NO_ID UINT32_MAX
+
+// -- writing
+//
+// Everything here lives in plain malloc'd memory, so taking a snapshot
+// doesn't disturb the heap it's describing.
+
+typedef struct {
+  Obj*     obj;
+  uint32_t id;
+} IdSlot;
+
+// object addresses -> their index in the snapshot
+static struct {
+  IdSlot*  slots;
+  size_t   cap;
+  uint32_t count;
+} ids;
+
+typedef struct {
+  Obj* obj;
+  char name[LABEL_MAX + 16];
+} Root;
+
+static struct {
+  Root*  items;
+  size_t count;
+  size_t cap;
+} roots;
+
+static FILE* out;
+
+// (for the visitors, which don't take a context)
+static uint32_t* refs;
+static uint32_t  ref_count;
+static size_t    ref_cap;
+
+static volatile sig_atomic_t snapshot_requested = 0;
+static int snapshot_count = 0;
+
+static size_t id_index(Obj* obj) {
+  uintptr_t hash = (uintptr_t) obj >> 4;
+  hash ^= hash >> 17;
+  hash *= 0x9e3779b97f4a7c15ULL;
+  return (size_t) (hash ^ (hash >> 29)) & (ids.cap - 1);
+}
+
+static uint32_t find_id(Obj* obj) {
+  if (obj == NULL) return NO_ID;
+
+  for (size_t i = id_index(obj);; i = (i + 1) & (ids.cap - 1)) {
+    if (ids.slots[i].obj == obj) return ids.slots[i].id;
+    if (ids.slots[i].obj == NULL) return NO_ID;
+  }
+}
+
+static void assign_id(Obj* obj) {
+  size_t i = id_index(obj);
+  while (ids.slots[i].obj != NULL) i = (i + 1) & (ids.cap - 1);
+
+  ids.slots[i].obj = obj;
+  ids.slots[i].id = ids.count++;
+}
+
+static void count_object(Obj* obj) {
+  (void) obj; // (it's a `walk_heap` callback, only the count matters)
+  ids.count++;
+}
+
+static void write_u8(uint8_t n)   { fwrite(&n, sizeof(n), 1, out); }
+static void write_u16(uint16_t n) { fwrite(&n, sizeof(n), 1, out); }
+static void write_u32(uint32_t n) { fwrite(&n, sizeof(n), 1, out); }
+
+static void write_label(const char* chars, size_t len) {
+  if (len > LABEL_MAX) len = LABEL_MAX;
+  write_u16((uint16_t) len);
+  if (len > 0) fwrite(chars, 1, len, out);
+}
+
+static const char* function_name(ObjFunction* func) {
+  return func->name == NULL ? "<script>" : func->name->chars;
+}
+
+// Young objects that have died (but haven't been collected yet) can
+// still point at old objects that were freed since, so an object is only
+// looked into if it's one of the objects in the snapshot (and its type is
+// what's expected). The label may be stale, but it's of garbage anyway.
+static bool is_snapshot_object(Obj* obj, ObjType type) {
+  return find_id(obj) != NO_ID && obj_type(obj) == type;
+}
+
+static void write_function_label(ObjFunction* func) {
+  if (!is_snapshot_object((Obj*) func, OBJ_FUNCTION) ||
+      (func->name != NULL && !is_snapshot_object((Obj*) func->name, OBJ_STRING))) {
+    write_label(NULL, 0);
+    return;
+  }
+
+  const char* name = function_name(func);
+  write_label(name, strlen(name));
+}
+
+static void collect_ref(Obj** slot) {
+  uint32_t id = find_id(*slot);
+  if (id == NO_ID) return; // (e.g. a half-built object's empty slot)
+
+  if (ref_count == ref_cap) {
+    ref_cap = ref_cap < 8 ? 8 : ref_cap * 2;
+    refs = realloc(refs, sizeof(uint32_t) * ref_cap);
+    if (refs == NULL) exit(1);
+  }
+
+  refs[ref_count++] = id;
+}
+
+static void write_object(Obj* obj) {
+  write_u8((uint8_t) obj_type(obj));
+  write_u32((uint32_t) (object_size(obj) + object_payload_size(obj)));
+
+  switch (obj_type(obj)) {
+    case OBJ_CLOSURE:
+      write_function_label(((ObjClosure*) obj)->function);
+      break;
+    case OBJ_FUNCTION:
+      write_function_label((ObjFunction*) obj);
+      break;
+    case OBJ_NATIVE: {
+      const char* name = natives[((ObjNative*) obj)->id].name;
+      write_label(name, strlen(name));
+      break;
+    }
+    case OBJ_SLICE: {
+      ObjSlice* slice = (ObjSlice*) obj;
+      ObjString* parent = slice->parent;
+      if (is_snapshot_object((Obj*) parent, OBJ_STRING) && slice->offset + slice->len <= parent->len) {
+        write_label(parent->chars + slice->offset, slice->len);
+      } else {
+        write_label(NULL, 0);
+      }
+      break;
+    }
+    case OBJ_STRING:
+      write_label(((ObjString*) obj)->chars, ((ObjString*) obj)->len);
+      break;
+    case OBJ_UPVALUE:
+      write_label(NULL, 0);
+      break;
+  }
+
+  ref_count = 0;
+  visit_references(obj, collect_ref);
+
+  write_u32(ref_count);
+  if (ref_count > 0) fwrite(refs, sizeof(uint32_t), ref_count, out);
+}
+
+// (`name` is optional, e.g. "global" and "x" for the global `x`)
+static void add_root(Obj* obj, const char* kind, const char* name) {
+  if (find_id(obj) == NO_ID) return;
+
+  if (roots.count == roots.cap) {
+    roots.cap = roots.cap < 64 ? 64 : roots.cap * 2;
+    roots.items = realloc(roots.items, sizeof(Root) * roots.cap);
+    if (roots.items == NULL) exit(1);
+  }
+
+  Root* root = &roots.items[roots.count++];
+  root->obj = obj;
+  if (name == NULL) {
+    snprintf(root->name, sizeof(root->name), "%s", kind);
+  } else {
+    snprintf(root->name, sizeof(root->name), "%s %.*s", kind, LABEL_MAX, name);
+  }
+}
+
+static void add_table_roots(Table* tab, const char* kind) {
+  size_t cursor = 0;
+  for (Entry* entry; (entry = table_next(tab, &cursor)) != NULL;) {
+    // (roots are labeled with their key, if it's a string)
+    const char* name = IS_STRING(entry->key) ? AS_CSTRING(entry->key) : NULL;
+    if (IS_OBJ(entry->key))   add_root(AS_OBJ(entry->key), kind, name);
+    if (IS_OBJ(entry->value)) add_root(AS_OBJ(entry->value), kind, name);
+  }
+}
+
+// (the same roots the collector marks from, see `mark_roots`)
+static void collect_roots() {
+  roots.count = 0;
+
+  for (Value* slot = vm.stack; slot < vm.stack_top; slot++) {
+    if (IS_OBJ(*slot)) add_root(AS_OBJ(*slot), "stack", NULL);
+  }
+
+  for (int i = 0; i < vm.frame_count; i++) {
+    ObjClosure* closure = vm.frames[i].closure;
+    add_root((Obj*) closure, "frame", function_name(closure->function));
+  }
+
+  for (ObjUpvalue* uv = vm.open_upvalues; uv != NULL; uv = uv->next) {
+    add_root((Obj*) uv, "open upvalue", NULL);
+  }
+
+  add_table_roots(&vm.globals, "global");
+  add_table_roots(&vm.consts, "const");
+  add_table_roots(&vm.declared, "declared");
+}
+
+long write_heap_snapshot(const char* path) {
+  out = fopen(path, "wb");
+  if (out == NULL) return -1;
+
+  // number every object (in the order they'll be written)
+  ids.count = 0;
+  walk_heap(count_object);
+
+  ids.cap = 16;
+  while (ids.cap < (size_t) ids.count * 2) ids.cap *= 2;
+  ids.slots = calloc(ids.cap, sizeof(IdSlot));
+  if (ids.slots == NULL) exit(1);
+
+  ids.count = 0;
+  walk_heap(assign_id);
+
+  collect_roots();
+
+  fwrite(SNAPSHOT_MAGIC, 1, strlen(SNAPSHOT_MAGIC), out);
+  write_u32(SNAPSHOT_VERSION);
+  write_u32(ids.count);
+  write_u32((uint32_t) roots.count);
+
+  walk_heap(write_object);
+
+  for (size_t i = 0; i < roots.count; i++) {
+    write_u32(find_id(roots.items[i].obj));
+    write_label(roots.items[i].name, strlen(roots.items[i].name));
+  }
+
+  bool ok = !ferror(out);
+  fclose(out);
+
+  long count = ids.count;
+  free(ids.slots);
+  ids.slots = NULL;
+
+  return ok ? count : -1;
+}
+
+void request_heap_snapshot() {
+  snapshot_requested = 1;
+  vm.safepoint_requested = true;
+}
+
+void take_requested_heap_snapshot() {
+  if (!snapshot_requested) return;
+  snapshot_requested = 0;
+
+  char path[64];
+  snprintf(path, sizeof(path), "clox-%d-%d.heap", (int) getpid(), ++snapshot_count);
+
+  long count = write_heap_snapshot(path);
+  if (count < 0) {
+    fprintf(stderr, "could not write heap snapshot to \"%s\".\n", path);
+  } else {
+    fprintf(stderr, "heap snapshot (%ld objects) written to %s\n", count, path);
+  }
+}
+
+// -- analysis
+//
+// Node 0 is a synthetic root that points to every real root, and object
+// `i` in the file is node `i + 1`. Immediate dominators are found with
+// the iterative algorithm from Cooper, Harvey and Kennedy ("A Simple,
+// Fast Dominance Algorithm"), which is quick on graphs shaped like heaps.
+
+typedef struct {
+  uint32_t  count;     // nodes (objects, plus the synthetic root)
+  uint8_t*  type;
+  uint32_t* size;
+  char**    label;
+
+  uint32_t* edge_start; // node `n`'s references are
+  uint32_t* edges;      // edges[edge_start[n] .. edge_start[n + 1]]
+
+  uint32_t  root_count;
+  uint32_t* root_node;
+  char**    root_name;
+} Graph;
+
+static bool read_exact(FILE* f, void* buf, size_t len) {
+  return fread(buf, 1, len, f) == len;
+}
+
+static char* read_label(FILE* f) {
+  uint16_t len;
+  if (!read_exact(f, &len, sizeof(len))) return NULL;
+
+  char* label = malloc(len + 1);
+  if (label == NULL) exit(1);
+  if (!read_exact(f, label, len)) {
+    free(label);
+    return NULL;
+  }
+
+  // (keep the report on one line per object)
+  for (uint16_t i = 0; i < len; i++) {
+    if (label[i] == '\n' || label[i] == '\t') label[i] = ' ';
+  }
+  label[len] = '\0';
+
+  return label;
+}
+
+static bool read_graph(FILE* f, Graph* g) {
+  char magic[sizeof(SNAPSHOT_MAGIC) - 1];
+  uint32_t version, object_count;
+
+  if (!read_exact(f, magic, sizeof(magic)) || memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) != 0) {
+    return false;
+  }
+  if (!read_exact(f, &version, sizeof(version)) || version != SNAPSHOT_VERSION) return false;
+  if (!read_exact(f, &object_count, sizeof(object_count))) return false;
+  if (!read_exact(f, &g->root_count, sizeof(g->root_count))) return false;
+
+  g->count = object_count + 1;
+  g->type = calloc(g->count, sizeof(uint8_t));
+  g->size = calloc(g->count, sizeof(uint32_t));
+  g->label = calloc(g->count, sizeof(char*));
+  g->edge_start = calloc(g->count + 1, sizeof(uint32_t));
+  g->root_node = calloc(g->root_count, sizeof(uint32_t));
+  g->root_name = calloc(g->root_count, sizeof(char*));
+  if (!g->type || !g->size || !g->label || !g->edge_start || !g->root_node || !g->root_name) exit(1);
+
+  size_t edge_cap = 1024;
+  size_t edge_count = 0;
+  g->edges = malloc(sizeof(uint32_t) * edge_cap);
+  if (g->edges == NULL) exit(1);
+
+  for (uint32_t n = 1; n < g->count; n++) {
+    uint32_t ref_count;
+    if (!read_exact(f, &g->type[n], sizeof(uint8_t))) return false;
+    if (!read_exact(f, &g->size[n], sizeof(uint32_t))) return false;
+    if ((g->label[n] = read_label(f)) == NULL) return false;
+    if (!read_exact(f, &ref_count, sizeof(ref_count))) return false;
+    if (g->type[n] >= OBJ_TYPE_COUNT) return false;
+
+    while (edge_count + ref_count > edge_cap) edge_cap *= 2;
+    g->edges = realloc(g->edges, sizeof(uint32_t) * edge_cap);
+    if (g->edges == NULL) exit(1);
+
+    g->edge_start[n] = (uint32_t) edge_count;
+    if (!read_exact(f, &g->edges[edge_count], sizeof(uint32_t) * ref_count)) return false;
+
+    for (uint32_t i = 0; i < ref_count; i++) {
+      if (g->edges[edge_count + i] >= object_count) return false;
+      g->edges[edge_count + i]++; // (object ids -> nodes)
+    }
+    edge_count += ref_count;
+  }
+  g->edge_start[g->count] = (uint32_t) edge_count;
+
+  for (uint32_t i = 0; i < g->root_count; i++) {
+    if (!read_exact(f, &g->root_node[i], sizeof(uint32_t))) return false;
+    if (g->root_node[i] >= object_count) return false;
+    g->root_node[i]++;
+    if ((g->root_name[i] = read_label(f)) == NULL) return false;
+  }
+
+  return true;
+}
+
+static void free_graph(Graph* g) {
+  for (uint32_t n = 0; n < g->count && g->label != NULL; n++) free(g->label[n]);
+  for (uint32_t i = 0; i < g->root_count && g->root_name != NULL; i++) free(g->root_name[i]);
+  free(g->type);
+  free(g->size);
+  free(g->label);
+  free(g->edge_start);
+  free(g->edges);
+  free(g->root_node);
+  free(g->root_name);
+}
+
+// successors of `n` (the synthetic root's are the real roots)
+static uint32_t* successors(Graph* g, uint32_t n, uint32_t* count) {
+  if (n == 0) {
+    *count = g->root_count;
+    return g->root_node;
+  }
+
+  *count = g->edge_start[n + 1] - g->edge_start[n];
+  return &g->edges[g->edge_start[n]];
+}
+
+// Number the nodes reachable from the synthetic root in postorder
+// (iteratively, since chains of objects can be very long), returning
+// how many there are. `order` lists them in reverse postorder.
+static uint32_t number_nodes(Graph* g, uint32_t* postorder, uint32_t* order) {
+  uint32_t* stack = malloc(sizeof(uint32_t) * g->count);
+  uint32_t* next_edge = calloc(g->count, sizeof(uint32_t));
+  if (stack == NULL || next_edge == NULL) exit(1);
+
+  for (uint32_t n = 0; n < g->count; n++) postorder[n] = NO_ID;
+
+  uint32_t depth = 0;
+  uint32_t numbered = 0;
+  stack[depth++] = 0;
+  postorder[0] = 0; // (marks nodes as visited, until they're numbered)
+
+  while (depth > 0) {
+    uint32_t n = stack[depth - 1];
+    uint32_t count;
+    uint32_t* succ = successors(g, n, &count);
+
+    if (next_edge[n] < count) {
+      uint32_t m = succ[next_edge[n]++];
+      if (postorder[m] == NO_ID) {
+        postorder[m] = 0;
+        stack[depth++] = m;
+      }
+      continue;
+    }
+
+    depth--;
+    postorder[n] = numbered++;
+  }
+
+  for (uint32_t n = 0; n < g->count; n++) {
+    if (postorder[n] != NO_ID) order[numbered - 1 - postorder[n]] = n;
+  }
+
+  free(stack);
+  free(next_edge);
+  return numbered;
+}
+
+static uint32_t intersect(uint32_t* idom, uint32_t* postorder, uint32_t a, uint32_t b) {
+  while (a != b) {
+    while (postorder[a] < postorder[b]) a = idom[a];
+    while (postorder[b] < postorder[a]) b = idom[b];
+  }
+  return a;
+}
+
+static void find_dominators(Graph* g, uint32_t* order, uint32_t reachable,
+                            uint32_t* postorder, uint32_t* idom) {
+  // predecessors (among reachable nodes), in the same layout as edges
+  uint32_t* pred_start = calloc(g->count + 1, sizeof(uint32_t));
+  if (pred_start == NULL) exit(1);
+
+  for (uint32_t i = 0; i < reachable; i++) {
+    uint32_t count;
+    uint32_t* succ = successors(g, order[i], &count);
+    for (uint32_t j = 0; j < count; j++) pred_start[succ[j] + 1]++;
+  }
+  for (uint32_t n = 0; n < g->count; n++) pred_start[n + 1] += pred_start[n];
+
+  uint32_t* preds = malloc(sizeof(uint32_t) * (pred_start[g->count] + 1));
+  uint32_t* fill = malloc(sizeof(uint32_t) * g->count);
+  if (preds == NULL || fill == NULL) exit(1);
+  memcpy(fill, pred_start, sizeof(uint32_t) * g->count);
+
+  for (uint32_t i = 0; i < reachable; i++) {
+    uint32_t count;
+    uint32_t* succ = successors(g, order[i], &count);
+    for (uint32_t j = 0; j < count; j++) preds[fill[succ[j]]++] = order[i];
+  }
+
+  for (uint32_t n = 0; n < g->count; n++) idom[n] = NO_ID;
+  idom[0] = 0;
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+
+    for (uint32_t i = 1; i < reachable; i++) {
+      uint32_t n = order[i];
+      uint32_t new_idom = NO_ID;
+
+      for (uint32_t j = pred_start[n]; j < pred_start[n + 1]; j++) {
+        uint32_t p = preds[j];
+        if (idom[p] == NO_ID) continue; // (not processed yet)
+        new_idom = new_idom == NO_ID ? p : intersect(idom, postorder, p, new_idom);
+      }
+
+      if (idom[n] != new_idom) {
+        idom[n] = new_idom;
+        changed = true;
+      }
+    }
+  }
+
+  free(pred_start);
+  free(preds);
+  free(fill);
+}
+
+// (for sorting nodes by retained size)
+static uint64_t* sort_retained;
+
+static int by_retained(const void* a, const void* b) {
+  uint64_t ra = sort_retained[*(uint32_t*) a];
+  uint64_t rb = sort_retained[*(uint32_t*) b];
+  return (rb > ra) - (rb < ra);
+}
+
+static void print_analysis(Graph* g) {
+  uint32_t* postorder = malloc(sizeof(uint32_t) * g->count);
+  uint32_t* order = malloc(sizeof(uint32_t) * g->count);
+  uint32_t* idom = malloc(sizeof(uint32_t) * g->count);
+  uint64_t* retained = calloc(g->count, sizeof(uint64_t));
+  uint32_t* dominated = calloc(g->count, sizeof(uint32_t)); // (object counts)
+  if (!postorder || !order || !idom || !retained || !dominated) exit(1);
+
+  uint32_t reachable = number_nodes(g, postorder, order);
+  find_dominators(g, order, reachable, postorder, idom);
+
+  // children come after their dominators in reverse postorder, so
+  // walking it backwards totals up each dominator subtree
+  for (uint32_t i = 0; i < reachable; i++) retained[order[i]] = g->size[order[i]];
+  for (uint32_t i = reachable - 1; i > 0; i--) {
+    uint32_t n = order[i];
+    retained[idom[n]] += retained[n];
+    dominated[idom[n]] += dominated[n] + 1;
+  }
+
+  uint64_t total = 0;
+  size_t type_count[OBJ_TYPE_COUNT] = {0};
+  uint64_t type_bytes[OBJ_TYPE_COUNT] = {0};
+  uint64_t type_reachable[OBJ_TYPE_COUNT] = {0};
+
+  for (uint32_t n = 1; n < g->count; n++) {
+    total += g->size[n];
+    type_count[g->type[n]]++;
+    type_bytes[g->type[n]] += g->size[n];
+    if (postorder[n] != NO_ID) type_reachable[g->type[n]] += g->size[n];
+  }
+
+  printf("%u objects, %.1f KB (%.1f KB reachable from %u roots, %.1f KB garbage awaiting collection)\n",
+         g->count - 1, total / 1024.0, retained[0] / 1024.0, g->root_count,
+         (total - retained[0]) / 1024.0);
+
+  printf("\n  %-8s %10s %12s %14s\n", "type", "count", "KB", "reachable KB");
+  for (int i = 0; i < OBJ_TYPE_COUNT; i++) {
+    printf("  %-8s %10zu %12.1f %14.1f\n", obj_type_names[i], type_count[i],
+           type_bytes[i] / 1024.0, type_reachable[i] / 1024.0);
+  }
+
+  // the biggest retainers are the biggest subtrees hanging directly off
+  // the roots (anything below them is part of their retained size)
+  uint32_t* top = malloc(sizeof(uint32_t) * g->count);
+  if (top == NULL) exit(1);
+
+  uint32_t top_count = 0;
+  for (uint32_t i = 1; i < reachable; i++) {
+    if (idom[order[i]] == 0) top[top_count++] = order[i];
+  }
+
+  sort_retained = retained;
+  qsort(top, top_count, sizeof(uint32_t), by_retained);
+
+  // which root (if any) holds each of them directly
+  char** held_by = calloc(g->count, sizeof(char*));
+  if (held_by == NULL) exit(1);
+  for (uint32_t i = 0; i < g->root_count; i++) {
+    if (held_by[g->root_node[i]] == NULL) held_by[g->root_node[i]] = g->root_name[i];
+  }
+
+  printf("\n  biggest retainers:\n");
+  printf("  %12s %10s %10s  %-8s %-24s %s\n",
+         "retained KB", "objects", "shallow B", "type", "label", "held by");
+  for (uint32_t i = 0; i < top_count && i < TOP_RETAINERS; i++) {
+    uint32_t n = top[i];
+    printf("  %12.1f %10u %10u  %-8s %-24.24s %s\n", retained[n] / 1024.0, dominated[n] + 1,
+           g->size[n], obj_type_names[g->type[n]], g->label[n],
+           held_by[n] == NULL ? "(several roots)" : held_by[n]);
+  }
+
+  free(held_by);
+  free(top);
+  free(postorder);
+  free(order);
+  free(idom);
+  free(retained);
+  free(dominated);
+}
+
+bool analyze_heap_snapshot(const char* path) {
+  FILE* f = fopen(path, "rb");
+  if (f == NULL) return false;
+
+  Graph g = {0};
+  bool ok = read_graph(f, &g);
+  fclose(f);
+
+  if (ok) print_analysis(&g);
+  free_graph(&g);
+
+  return ok;
+}
+
+// ---
+
+#undef SNAPSHOT_MAGIC
+#undef SNAPSHOT_VERSION
+#undef LABEL_MAX
+#undef TOP_RETAINERS
+#undef NO_ID
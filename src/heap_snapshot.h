@@ -0,0 +1,45 @@
+#ifndef __CLOX_HEAP_SNAPSHOT_H__
+#define __CLOX_HEAP_SNAPSHOT_H__
+
+#include "common.h"
+
+/**
+ * Write every object on the heap (its type, size, a short label, and
+ * the objects it references) along with the roots that hold on to them,
+ * to a compact binary file that `analyze_heap_snapshot` can read back.
+ *
+ * The file is laid out as (all integers in host byte order):
+ *
+ *     "CLOXHEAP"  u32 version  u32 object_count  u32 root_count
+ *     object*:    u8 type  u32 size  u16 label_len  label  u32 ref_count  u32 ref*
+ *     root*:      u32 object  u16 name_len  name
+ *
+ * where objects are referred to by their index in the file. Objects that
+ * are dead but haven't been collected yet are included (but aren't
+ * reachable from any root).
+ *
+ * @return the number of objects written, or -1 if the file couldn't be
+ *         written
+ */
+long write_heap_snapshot(const char* path);
+
+/**
+ * Ask for a snapshot at the next safepoint (safe to call from a signal
+ * handler). It's written to "clox-<pid>-<n>.heap" in the working directory.
+ */
+void request_heap_snapshot();
+
+/** Write a snapshot, if one was asked for (see `request_heap_snapshot`). */
+void take_requested_heap_snapshot();
+
+/**
+ * Read a snapshot back and print what's holding on to memory: totals by
+ * type, and the objects that retain the most (everything they dominate,
+ * i.e. everything that would be freed if they were), with the roots that
+ * hold them.
+ *
+ * @return false if the file couldn't be read
+ */
+bool analyze_heap_snapshot(const char* path);
+
+#endif // __CLOX_HEAP_SNAPSHOT_H__
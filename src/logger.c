@@ -23,6 +23,11 @@ void err_printf(const char* fmt, ...) {
   va_end(args);
 }
 
+// write pre-formatted output, skipping format string parsing
+void out_write(const char* chars, size_t len) {
+  fwrite(chars, sizeof(char), len, out_stream);
+}
+
 void logger_redirect_out(FILE* stream) { out_stream = stream; }
 
 void logger_redirect_err(FILE* stream) { err_stream = stream; }
@@ -9,6 +9,8 @@ void out_printf(const char* fmt, ...);
 
 void err_printf(const char* fmt, ...);
 
+void out_write(const char* chars, size_t len);
+
 void logger_redirect_out(FILE* stream);
 
 void logger_redirect_err(FILE* stream);
@@ -1,4 +1,5 @@
 #include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -6,7 +7,12 @@
 #include "common.h"
 #include "chunk.h"
 #include "debug.h"
+#include "gc.h"
+#include "heap_profile.h"
+#include "heap_snapshot.h"
 #include "logger.h"
+#include "mem_stats.h"
+#include "parallel_mark.h"
 #include "repl.h"
 #include "signal_handlers.h"
 #include "vm.h"
@@ -41,15 +47,119 @@ static char* read_file(const char* path) {
   return buf;
 }
 
+// reports to print on exit (see `--gc-stats` and `--mem-stats`)
+static bool gc_stats = false;
+static bool mem_stats = false;
+static const char* heap_profile = NULL; // (see `--heap-profile`)
+
+static void print_stats() {
+  if (gc_stats) print_gc_stats();
+  if (mem_stats) print_mem_stats();
+  if (heap_profile != NULL) write_heap_profile(heap_profile);
+}
+
 static void run_file(const char* path) {
   char* source = read_file(path);
   InterpretResult res = interpret(source);
   free(source);
 
+  if (res != INTERPRET_OK) print_stats();
+
   if (res == INTERPRET_COMPILE_ERR) exit(EX_DATAERR);
   if (res == INTERPRET_RUNTIME_ERR) exit(EX_SOFTWARE);
 }
 
+#define USAGE \
+  "Usage: clox [options] [path]\n" \
+  "\n" \
+  "Options:\n" \
+  "  --gc-stats         print GC pause times on exit\n" \
+  "  --gc-threads=<n>   mark the heap with <n> threads (1 to 64)\n" \
+  "  --gc-grow=<factor> let the heap grow by <factor> between collections\n" \
+  "                     (default 2, lower trades throughput for footprint)\n" \
+  "  --gc-min-heap=<bytes>\n" \
+  "                     don't collect until the heap is this big (default 1M)\n" \
+  "  --max-heap=<bytes> stop the script with a runtime error if the heap\n" \
+  "                     can't be kept under <bytes> (e.g. 64M)\n" \
+  "  --compact[=<percent>]\n" \
+  "                     after a collection, move objects out of sparse\n" \
+  "                     slabs (and release them) once <percent> of slab\n" \
+  "                     memory is unused (default 50, 0 for every time)\n" \
+  "  --max-pause=<ms>   collect garbage incrementally, aiming to keep\n" \
+  "                     each pause under <ms> milliseconds\n" \
+  "  --mem-stats        print where memory went (by object type, bytecode\n" \
+  "                     and tables) on exit\n" \
+  "  --heap-profile=<path>\n" \
+  "                     sample allocations by Lox call stack, writing\n" \
+  "                     them to <path> (as folded stacks) on exit\n" \
+  "  --heap-sample=<bytes>\n" \
+  "                     sample about once every <bytes> allocated\n" \
+  "                     (default 4096)\n" \
+  "  --heap-analyze <snapshot>\n" \
+  "                     report what's retaining memory in a heap snapshot\n" \
+  "                     (from heapSnapshot(path), or kill -USR1), then exit\n"
+
+static void usage_error() {
+  fprintf(stderr, USAGE);
+  exit(EX_USAGE);
+}
+
+// match `--name=<value>`, pointing `value` at the part after the `=`
+static bool match_option(const char* arg, const char* name, const char** value) {
+  size_t len = strlen(name);
+  if (strncmp(arg, name, len) != 0 || arg[len] != '=') return false;
+
+  *value = arg + len + 1;
+  return true;
+}
+
+static double parse_ms(const char* value) {
+  char* end;
+  double ms = strtod(value, &end);
+  if (end == value || *end != '\0' || ms < 0) usage_error();
+  return ms;
+}
+
+// a number of bytes, optionally with a K, M or G suffix (e.g. 64M)
+static size_t parse_bytes(const char* value) {
+  char* end;
+  errno = 0;
+  long long n = strtoll(value, &end, 10);
+  if (end == value || n < 1 || errno == ERANGE) usage_error();
+
+  int shift = 0;
+  switch (*end) {
+    case 'K': case 'k': shift = 10; end++; break;
+    case 'M': case 'm': shift = 20; end++; break;
+    case 'G': case 'g': shift = 30; end++; break;
+  }
+  if (*end != '\0' || n > LLONG_MAX >> shift) usage_error();
+  n <<= shift;
+
+  return (size_t) n;
+}
+
+static double parse_factor(const char* value) {
+  char* end;
+  double factor = strtod(value, &end);
+  if (end == value || *end != '\0' || factor <= 1) usage_error();
+  return factor;
+}
+
+static double parse_percent(const char* value) {
+  char* end;
+  double percent = strtod(value, &end);
+  if (end == value || *end != '\0' || percent < 0 || percent > 100) usage_error();
+  return percent;
+}
+
+static int parse_threads(const char* value) {
+  char* end;
+  long n = strtol(value, &end, 10);
+  if (end == value || *end != '\0' || n < 1 || n > MARK_THREADS_MAX) usage_error();
+  return (int) n;
+}
+
 #ifndef __TESTING__
 int main(int argc, const char* argv[]) {
 #define LINE_NO 123
@@ -58,13 +168,64 @@ int main(int argc, const char* argv[]) {
   init_logger();
   init_vm();
 
-  if      (argc == 1) repl();
-  else if (argc == 2) run_file(argv[1]);
-  else {
-    fprintf(stderr, "Usage: clox [path]\n");
-    exit(EX_USAGE);
+  const char* path = NULL;
+  size_t heap_sample = HEAP_SAMPLE_DEFAULT;
+  const char* heap_analyze = NULL;
+
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    const char* value;
+
+    if (strcmp(arg, "--gc-stats") == 0) {
+      gc_stats = true;
+    } else if (strcmp(arg, "--mem-stats") == 0) {
+      mem_stats = true;
+    } else if (match_option(arg, "--heap-profile", &value)) {
+      heap_profile = value;
+    } else if (strcmp(arg, "--heap-analyze") == 0 && i + 1 < argc) {
+      heap_analyze = argv[++i];
+    } else if (match_option(arg, "--heap-analyze", &value)) {
+      heap_analyze = value;
+    } else if (match_option(arg, "--heap-sample", &value)) {
+      heap_sample = parse_bytes(value);
+    } else if (match_option(arg, "--max-pause", &value)) {
+      vm.gc_max_pause = parse_ms(value);
+    } else if (match_option(arg, "--gc-threads", &value)) {
+      vm.gc_threads = parse_threads(value);
+    } else if (match_option(arg, "--gc-grow", &value)) {
+      vm.gc_grow_factor = parse_factor(value);
+    } else if (match_option(arg, "--gc-min-heap", &value)) {
+      vm.gc_heap_min = parse_bytes(value);
+    } else if (match_option(arg, "--max-heap", &value)) {
+      vm.max_heap = parse_bytes(value);
+    } else if (strcmp(arg, "--compact") == 0) {
+      vm.gc_compact = GC_COMPACT_DEFAULT;
+    } else if (match_option(arg, "--compact", &value)) {
+      vm.gc_compact = parse_percent(value);
+    } else if (arg[0] == '-' || path != NULL) {
+      usage_error();
+    } else {
+      path = arg;
+    }
   }
 
+  if (heap_analyze != NULL) {
+    if (!analyze_heap_snapshot(heap_analyze)) {
+      fprintf(stderr, "could not read heap snapshot \"%s\".\n", heap_analyze);
+      exit(EX_DATAERR);
+    }
+
+    free_vm();
+    return 0;
+  }
+
+  if (heap_profile != NULL) vm.heap_sample = heap_sample;
+  schedule_next_gc(); // (with the tunables above)
+
+  if (path == NULL) repl();
+  else              run_file(path);
+
+  print_stats();
   free_vm();
 
   return 0;
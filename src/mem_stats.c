@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+#include "gc.h"
+#include "memory.h"
+#include "mem_stats.h"
+#include "vm.h"
+
+// how many of the biggest chunks to list
+#define LARGEST_CHUNKS 5
+
+typedef struct {
+  size_t count;
+  size_t bytes; // (including any memory the objects own)
+} Tally;
+
+// every object ever allocated (counted as they're created, since young
+// objects die without ever being individually freed)
+static Tally allocated[OBJ_TYPE_COUNT];
+
+// what's alive right now (counted by walking the heap when asked)
+static struct {
+  Tally live[OBJ_TYPE_COUNT];
+
+  size_t code_bytes;
+  size_t constant_bytes;
+  size_t line_bytes;
+  ObjFunction* largest[LARGEST_CHUNKS]; // biggest first
+} census;
+
+void count_allocation(ObjType type, size_t size) {
+  allocated[type].count++;
+  allocated[type].bytes += size;
+}
+
+void count_payload(ObjType type, size_t size) {
+  allocated[type].bytes += size;
+}
+
+static size_t chunk_size(ObjFunction* func) {
+  return object_payload_size((Obj*) func);
+}
+
+static void count_object(Obj* obj) {
+  Tally* tally = &census.live[obj_type(obj)];
+  tally->count++;
+  tally->bytes += object_size(obj) + object_payload_size(obj);
+
+  if (obj_type(obj) != OBJ_FUNCTION) return;
+
+  ObjFunction* func = (ObjFunction*) obj;
+  census.code_bytes += func->chunk.cap;
+  census.constant_bytes += sizeof(Value) * func->chunk.constants.cap;
+  census.line_bytes += sizeof(RLETuple) * func->chunk.lines.cap;
+
+  // insertion sort into the (short) list of the largest chunks
+  for (int i = 0; i < LARGEST_CHUNKS; i++) {
+    if (census.largest[i] == NULL || chunk_size(func) > chunk_size(census.largest[i])) {
+      memmove(&census.largest[i + 1], &census.largest[i],
+              sizeof(ObjFunction*) * (LARGEST_CHUNKS - i - 1));
+      census.largest[i] = func;
+      break;
+    }
+  }
+}
+
+static void take_census() {
+  memset(&census, 0, sizeof(census));
+  walk_heap(count_object);
+}
+
+static size_t peak_rss() {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+  return (size_t) usage.ru_maxrss * 1024; // (reported in KB)
+}
+
+// entries that hold a key (rather than being empty or tombstones)
+static size_t table_count(Table* tab) {
+  size_t count = 0;
+  size_t cursor = 0;
+  while (table_next(tab, &cursor) != NULL) count++;
+  return count;
+}
+
+static void print_table(const char* name, Table* tab) {
+  fprintf(stderr, "  %-8s %8zu entries, capacity %zu (%.1f KB)\n",
+          name, table_count(tab), tab->cap, table_bytes(tab) / 1024.0);
+}
+
+void print_mem_stats() {
+  take_census();
+
+  fprintf(stderr, "memory: heap %.1f KB (peak %.1f KB), nursery %.1f KB used, peak rss %.1f MB\n",
+          vm.bytes_allocated / 1024.0, vm.bytes_peak / 1024.0,
+          (vm.nursery.top - vm.nursery.start) / 1024.0, peak_rss() / (1024.0 * 1024.0));
+
+  fprintf(stderr, "  %-8s %10s %10s %12s %12s\n",
+          "type", "live", "live KB", "allocated", "alloc KB");
+  for (int i = 0; i < OBJ_TYPE_COUNT; i++) {
+    fprintf(stderr, "  %-8s %10zu %10.1f %12zu %12.1f\n", obj_type_names[i],
+            census.live[i].count, census.live[i].bytes / 1024.0,
+            allocated[i].count, allocated[i].bytes / 1024.0);
+  }
+
+  fprintf(stderr, "  chunks: %zu, code %.1f KB, constants %.1f KB, lines %.1f KB\n",
+          census.live[OBJ_FUNCTION].count, census.code_bytes / 1024.0,
+          census.constant_bytes / 1024.0, census.line_bytes / 1024.0);
+
+  for (int i = 0; i < LARGEST_CHUNKS && census.largest[i] != NULL; i++) {
+    ObjFunction* func = census.largest[i];
+    Chunk* chunk = &func->chunk;
+    fprintf(stderr, "    %-20s code %zu B, %zu constants, %zu line runs\n",
+            func->name == NULL ? "<script>" : func->name->chars,
+            chunk->cap, chunk->constants.cap, chunk->lines.cap);
+  }
+
+  print_table("strings", &vm.strings);
+  print_table("globals", &vm.globals);
+  print_table("consts", &vm.consts);
+  print_table("declared", &vm.declared);
+}
+
+// (names are things like "string.live", see `mem_stat`)
+static bool table_stat(const char* name, const char* field, Table* tab, double* out) {
+  size_t len = strlen(name);
+  if (strncmp(field, name, len) != 0 || field[len] != '.') return false;
+  field += len + 1;
+
+  if      (strcmp(field, "count") == 0)    *out = (double) table_count(tab);
+  else if (strcmp(field, "capacity") == 0) *out = (double) tab->cap;
+  else if (strcmp(field, "bytes") == 0)    *out = (double) table_bytes(tab);
+  else return false;
+
+  return true;
+}
+
+bool mem_stat(const char* chars, size_t len, double* out) {
+  char name[64];
+  if (len >= sizeof(name)) return false;
+  memcpy(name, chars, len);
+  name[len] = '\0';
+
+  if (strcmp(name, "heap") == 0)     { *out = (double) vm.bytes_allocated; return true; }
+  if (strcmp(name, "heapPeak") == 0) { *out = (double) vm.bytes_peak;      return true; }
+  if (strcmp(name, "rss") == 0)      { *out = (double) peak_rss();         return true; }
+
+  if (table_stat("strings", name, &vm.strings, out)) return true;
+  if (table_stat("globals", name, &vm.globals, out)) return true;
+  if (table_stat("consts", name, &vm.consts, out)) return true;
+
+  take_census();
+
+  if (strcmp(name, "code") == 0)      { *out = (double) census.code_bytes;     return true; }
+  if (strcmp(name, "constants") == 0) { *out = (double) census.constant_bytes; return true; }
+  if (strcmp(name, "lines") == 0)     { *out = (double) census.line_bytes;     return true; }
+
+  for (int i = 0; i < OBJ_TYPE_COUNT; i++) {
+    size_t type_len = strlen(obj_type_names[i]);
+    if (strncmp(name, obj_type_names[i], type_len) != 0 || name[type_len] != '.') continue;
+
+    const char* field = name + type_len + 1;
+    if      (strcmp(field, "live") == 0)           *out = (double) census.live[i].count;
+    else if (strcmp(field, "liveBytes") == 0)      *out = (double) census.live[i].bytes;
+    else if (strcmp(field, "allocated") == 0)      *out = (double) allocated[i].count;
+    else if (strcmp(field, "allocatedBytes") == 0) *out = (double) allocated[i].bytes;
+    else return false;
+
+    return true;
+  }
+
+  return false;
+}
+
+// ---
+
+#undef LARGEST_CHUNKS
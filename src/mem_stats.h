@@ -0,0 +1,31 @@
+#ifndef __CLOX_MEM_STATS_H__
+#define __CLOX_MEM_STATS_H__
+
+#include "common.h"
+#include "object.h"
+
+/** Count an object allocation (towards the cumulative per-type totals). */
+void count_allocation(ObjType type, size_t size);
+
+/**
+ * Count memory an object owns (like a string's characters) towards its
+ * type's cumulative total. A function's chunk is counted once it's
+ * sealed, at its final size (see `seal_chunk`).
+ */
+void count_payload(ObjType type, size_t size);
+
+/**
+ * Print where memory is going: live and cumulative object counts and
+ * bytes by type, bytecode sizes, table sizes, and high-water marks.
+ */
+void print_mem_stats();
+
+/**
+ * Look up a single figure from the memory report by name, for example
+ * "heap", "string.live" or "globals.count" (see `print_mem_stats`).
+ *
+ * @return false if there's no figure by that name
+ */
+bool mem_stat(const char* name, size_t len, double* out);
+
+#endif // __CLOX_MEM_STATS_H__
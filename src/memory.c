@@ -1,66 +1,179 @@
+#include <setjmp.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include "gc.h"
 #include "memory.h"
 #include "object.h"
+#include "slab.h"
 #include "vm.h"
 
-/**
- * TODO: hard-mode challenge
- *
- * Instead of using the `stdlib` memory allocator, try implementing your
- * own. You're allowed a single call to `malloc` during program init to
- * grab an initial block of memory, then expected to parcel out via your
- * own implementation of `realloc`.
- *
- * ref: https://code.woboq.org/userspace/glibc/malloc/malloc.c.html#1323
- */
+// Small blocks come from the slab allocator (see slab.c), and anything
+// bigger from the system allocator. Which one a block came from depends
+// only on its size, so callers must always pass the length a block was
+// actually allocated with as `old_len`.
+static void release(void* ptr, size_t len) {
+  if (IS_SLAB_SIZE(len)) slab_free(ptr, len);
+  else                   free(ptr);
+}
+
+void out_of_memory() {
+  // (nothing can be unwound in the middle of a collection)
+  if (vm.out_of_memory == NULL || vm.in_gc) {
+    fprintf(stderr, "out of memory.\n");
+    exit(1);
+  }
+
+  longjmp(*vm.out_of_memory, 1);
+}
+
+// (the block's been accounted for, but couldn't actually be allocated)
+static void allocation_failed(size_t old_len, size_t new_len) {
+  vm.bytes_allocated -= new_len - old_len;
+  out_of_memory();
+}
 
 void* reallocate(void* ptr, size_t old_len, size_t new_len) {
+  if (new_len > old_len && vm.max_heap > 0 &&
+      vm.bytes_allocated + (new_len - old_len) > vm.max_heap) {
+    enforce_heap_limit(new_len - old_len);
+  }
+
+  vm.bytes_allocated += new_len - old_len;
+
+  if (new_len > old_len) {
+    if (vm.bytes_allocated > vm.bytes_peak) vm.bytes_peak = vm.bytes_allocated;
+
+    // only collect when growing, so that freeing memory
+    // (including during a collection) never recurses
+    if (!vm.in_gc) gc_check_heap();
+  }
+
   // setting length to 0 is equivalent to deallocating
   if (new_len == 0) {
-    free(ptr);
+    release(ptr, old_len);
     return NULL;
   }
 
-  void* res = realloc(ptr, new_len);
-  if (res == NULL) exit(1); // nothing much else to do
+  if (!IS_SLAB_SIZE(old_len) && !IS_SLAB_SIZE(new_len)) {
+    void* res = realloc(ptr, new_len);
+    if (res == NULL) allocation_failed(old_len, new_len);
+    return res;
+  }
+
+  // still fits in the same block
+  if (old_len > 0 && IS_SLAB_SIZE(old_len) && IS_SLAB_SIZE(new_len) &&
+      SLAB_CLASS(old_len) == SLAB_CLASS(new_len)) {
+    return ptr;
+  }
+
+  void* res = IS_SLAB_SIZE(new_len) ? slab_allocate(new_len) : malloc(new_len);
+  if (res == NULL) allocation_failed(old_len, new_len);
+
+  if (old_len > 0) {
+    memcpy(res, ptr, old_len < new_len ? old_len : new_len);
+    release(ptr, old_len);
+  }
+
   return res;
 }
 
-static void free_object(Obj* obj) {
-  switch (obj->type) {
+size_t object_size(Obj* obj) {
+  switch (obj_type(obj)) {
+    case OBJ_CLOSURE:  return sizeof(ObjClosure);
+    case OBJ_FUNCTION: return sizeof(ObjFunction);
+    case OBJ_NATIVE:   return sizeof(ObjNative);
+    case OBJ_SLICE:    return sizeof(ObjSlice);
+    case OBJ_STRING:   return sizeof(ObjString);
+    case OBJ_UPVALUE:  return sizeof(ObjUpvalue);
+  }
+
+  return 0; // unreachable
+}
+
+size_t object_payload_size(Obj* obj) {
+  switch (obj_type(obj)) {
+    case OBJ_CLOSURE:
+      return sizeof(ObjUpvalue*) * ((ObjClosure*) obj)->upvalue_count;
+    case OBJ_FUNCTION: {
+      Chunk* chunk = &((ObjFunction*) obj)->chunk;
+      return chunk->cap +
+             sizeof(Value) * chunk->constants.cap +
+             sizeof(RLETuple) * chunk->lines.cap;
+    }
+    case OBJ_STRING:
+      return ((ObjString*) obj)->len + 1;
+    case OBJ_NATIVE:
+    case OBJ_SLICE:
+    case OBJ_UPVALUE:
+      break;
+  }
+
+  return 0;
+}
+
+void free_object_payload(Obj* obj) {
+  switch (obj_type(obj)) {
     case OBJ_CLOSURE: {
       ObjClosure* closure = (ObjClosure*) obj;
       FREE_ARRAY(ObjUpvalue*, closure->upvalues, closure->upvalue_count);
-      FREE(ObjClosure, obj);
-      break;
-    }
-    case OBJ_FUNCTION: {
-      ObjFunction* func = (ObjFunction*) obj;
-      free_chunk(&func->chunk);
-      FREE(ObjFunction, obj);
       break;
     }
-    case OBJ_NATIVE:
-      FREE(ObjNative, obj);
+    case OBJ_FUNCTION:
+      free_chunk(&((ObjFunction*) obj)->chunk);
       break;
     case OBJ_STRING: {
       ObjString* str = (ObjString*) obj;
       FREE_ARRAY(char, str->chars, str->len + 1);
-      FREE(ObjString, obj);
       break;
     }
+    case OBJ_NATIVE:
+    case OBJ_SLICE: // slices don't own their characters, the parent does
     case OBJ_UPVALUE:
-      FREE(ObjUpvalue, obj);
       break;
   }
 }
 
-void free_objects() {
-  Obj* obj = vm.objects;
+void free_object(Obj* obj) {
+#ifdef DEBUG_LOG_GC
+  fprintf(stderr, "%p free type %d\n", (void*) obj, obj_type(obj));
+#endif
+
+  free_object_payload(obj);
+  reallocate(obj, object_size(obj), 0);
+}
 
-  while (obj != NULL) {
-    Obj* next = obj->next;
-    free_object(obj);
-    obj = next;
+void visit_references(Obj* obj, ObjVisitor visit) {
+  // (the marker threads trace objects through here too)
+  switch (obj_type_atomic(obj)) {
+    case OBJ_CLOSURE: {
+      ObjClosure* closure = (ObjClosure*) obj;
+      visit((Obj**) &closure->function);
+      for (int i = 0; i < closure->upvalue_count; i++) {
+        visit((Obj**) &closure->upvalues[i]);
+      }
+      break;
+    }
+    case OBJ_FUNCTION: {
+      ObjFunction* func = (ObjFunction*) obj;
+      visit((Obj**) &func->name);
+
+      ValueArray* constants = &func->chunk.constants;
+      for (size_t i = 0; i < constants->len; i++) {
+        if (IS_OBJ(constants->values[i])) visit(&AS_OBJ(constants->values[i]));
+      }
+      break;
+    }
+    case OBJ_SLICE:
+      visit((Obj**) &((ObjSlice*) obj)->parent);
+      break;
+    case OBJ_UPVALUE: {
+      ObjUpvalue* uv = (ObjUpvalue*) obj;
+      if (IS_OBJ(uv->closed)) visit(&AS_OBJ(uv->closed));
+      break;
+    }
+    case OBJ_NATIVE:
+    case OBJ_STRING:
+      break; // no outgoing references
   }
 }
@@ -2,6 +2,7 @@
 #define __CLOX_MEMORY_H__
 
 #include "common.h"
+#include "value.h"
 
 #define ALLOCATE(type, count) \
   ((type*) reallocate(NULL, 0, sizeof(type) * (count)))
@@ -20,8 +21,37 @@
 #define FREE(type, ptr) \
   reallocate(ptr, sizeof(type), 0)
 
+typedef void (*ObjVisitor)(Obj** slot);
+
 void* reallocate(void* ptr, size_t old_len, size_t new_len);
 
-void free_objects();
+/**
+ * Give up on an allocation (the heap limit was reached, or the system
+ * ran out of memory): the running script is stopped with a runtime
+ * error, unwinding back to `interpret`. If there's no script running
+ * (or a collection is in progress), the process exits.
+ */
+void out_of_memory();
+
+size_t object_size(Obj* obj);
+
+/** @return the size of any memory owned by an object (see `free_object_payload`) */
+size_t object_payload_size(Obj* obj);
+
+/** Free any memory owned by an object (but not the object itself). */
+void free_object_payload(Obj* obj);
+
+/**
+ * Free an old-generation object (young objects are reclaimed
+ * all at once when the nursery is reset).
+ */
+void free_object(Obj* obj);
+
+/**
+ * Call `visit` with a pointer to each of an object's references, so
+ * that it can either follow them (when marking) or update them (when
+ * objects are moved).
+ */
+void visit_references(Obj* obj, ObjVisitor visit);
 
 #endif // __CLOX_MEMORY_H__
@@ -0,0 +1,312 @@
+#define _GNU_SOURCE // for memmem
+
+#include <math.h>
+#include <string.h>
+#include <time.h>
+#include "heap_snapshot.h"
+#include "memory.h"
+#include "mem_stats.h"
+#include "natives.h"
+#include "table.h"
+#include "vm.h"
+
+// Natives write their result to `out` and return true, or on failure
+// write an error message to `out` and return false (the VM reports it
+// as a runtime error). Arity is checked by the VM before the call, so
+// natives only need to validate argument types (and most ignore `argc`).
+static bool native_error(Value* out, const char* message) {
+  *out = OBJ_VAL((Obj*) copy_string(message, strlen(message)));
+  return false;
+}
+
+// -- misc. natives
+
+static bool clock_native(uint8_t argc, Value* argv, Value* out) {
+  (void) argc;
+  (void) argv;
+
+  *out = NUMBER_VAL((double) clock() / CLOCKS_PER_SEC);
+  return true;
+}
+
+// memStats(name), a figure from the `--mem-stats` report (like "heap",
+// "string.live" or "globals.count")
+static bool mem_stats_native(uint8_t argc, Value* argv, Value* out) {
+  (void) argc;
+
+  if (!is_string_like(argv[0])) return native_error(out, "memStats() expects a string.");
+
+  size_t len;
+  const char* name = string_like_chars(argv[0], &len);
+
+  double stat;
+  if (!mem_stat(name, len, &stat)) return native_error(out, "memStats() has no figure by that name.");
+
+  *out = NUMBER_VAL(stat);
+  return true;
+}
+
+// heapSnapshot(path), write a heap snapshot for `clox --heap-analyze`
+// (returning how many objects are in it)
+static bool heap_snapshot_native(uint8_t argc, Value* argv, Value* out) {
+  (void) argc;
+
+  if (!is_string_like(argv[0])) return native_error(out, "heapSnapshot() expects a path.");
+
+  size_t len;
+  const char* chars = string_like_chars(argv[0], &len);
+
+  char path[4096];
+  if (len >= sizeof(path)) return native_error(out, "heapSnapshot() path is too long.");
+  memcpy(path, chars, len);
+  path[len] = '\0';
+
+  long count = write_heap_snapshot(path);
+  if (count < 0) return native_error(out, "heapSnapshot() couldn't write the snapshot.");
+
+  *out = NUMBER_VAL((double) count);
+  return true;
+}
+
+// -- math natives
+//
+// The compiler turns direct calls to these into intrinsic ops (see
+// OP_SQRT etc.), so these are only used when they're called indirectly.
+
+static bool sqrt_native(uint8_t argc, Value* argv, Value* out) {
+  (void) argc;
+
+  if (!IS_NUMBER(argv[0])) return native_error(out, "sqrt() expects a number.");
+
+  *out = NUMBER_VAL(sqrt(AS_NUMBER(argv[0])));
+  return true;
+}
+
+static bool floor_native(uint8_t argc, Value* argv, Value* out) {
+  (void) argc;
+
+  if (!IS_NUMBER(argv[0])) return native_error(out, "floor() expects a number.");
+
+  *out = NUMBER_VAL(floor(AS_NUMBER(argv[0])));
+  return true;
+}
+
+static bool abs_native(uint8_t argc, Value* argv, Value* out) {
+  (void) argc;
+
+  if (!IS_NUMBER(argv[0])) return native_error(out, "abs() expects a number.");
+
+  *out = NUMBER_VAL(fabs(AS_NUMBER(argv[0])));
+  return true;
+}
+
+static bool min_native(uint8_t argc, Value* argv, Value* out) {
+  (void) argc;
+
+  if (!IS_NUMBER(argv[0]) || !IS_NUMBER(argv[1])) {
+    return native_error(out, "min() expects two numbers.");
+  }
+
+  *out = NUMBER_VAL(fmin(AS_NUMBER(argv[0]), AS_NUMBER(argv[1])));
+  return true;
+}
+
+static bool max_native(uint8_t argc, Value* argv, Value* out) {
+  (void) argc;
+
+  if (!IS_NUMBER(argv[0]) || !IS_NUMBER(argv[1])) {
+    return native_error(out, "max() expects two numbers.");
+  }
+
+  *out = NUMBER_VAL(fmax(AS_NUMBER(argv[0]), AS_NUMBER(argv[1])));
+  return true;
+}
+
+// -- string natives
+//
+// These all accept either strings or slices, and any substrings they
+// produce are slices into the original string (no copying/interning).
+
+// clamp a numeric argument (which mustn't be NaN) to [0, max]
+// (in double space, since casting a double that's out of range is undefined)
+static size_t clamp_index(Value val, size_t max) {
+  double n = AS_NUMBER(val);
+  if (n <= 0) return 0;
+  if (n >= (double) max) return max;
+  return (size_t) n;
+}
+
+// slice `[offset, offset + len)` out of a string or slice
+static Value slice_of(Value str, size_t offset, size_t len) {
+  if (IS_SLICE(str)) {
+    ObjSlice* slice = AS_SLICE(str);
+    return OBJ_VAL((Obj*) new_slice(slice->parent, slice->offset + offset, len));
+  }
+
+  // slicing the whole string is a no-op
+  if (offset == 0 && len == AS_STRING(str)->len) return str;
+
+  return OBJ_VAL((Obj*) new_slice(AS_STRING(str), offset, len));
+}
+
+// len(str)
+static bool len_native(uint8_t argc, Value* argv, Value* out) {
+  (void) argc;
+
+  if (!is_string_like(argv[0])) return native_error(out, "len() expects a string.");
+
+  size_t len;
+  string_like_chars(argv[0], &len);
+  *out = NUMBER_VAL((double) len);
+  return true;
+}
+
+// substr(str, start, len)
+static bool substr_native(uint8_t argc, Value* argv, Value* out) {
+  (void) argc;
+
+  if (!is_string_like(argv[0]) || !IS_NUMBER(argv[1]) || !IS_NUMBER(argv[2])) {
+    return native_error(out, "substr() expects a string, start index and length.");
+  }
+  if (isnan(AS_NUMBER(argv[1])) || isnan(AS_NUMBER(argv[2]))) {
+    return native_error(out, "substr() start index and length can't be NaN.");
+  }
+
+  size_t str_len;
+  string_like_chars(argv[0], &str_len);
+
+  size_t start = clamp_index(argv[1], str_len);
+  size_t len = clamp_index(argv[2], str_len - start);
+  *out = slice_of(argv[0], start, len);
+  return true;
+}
+
+// indexOf(str, needle), or -1 if `needle` isn't found
+static bool index_of_native(uint8_t argc, Value* argv, Value* out) {
+  (void) argc;
+
+  if (!is_string_like(argv[0]) || !is_string_like(argv[1])) {
+    return native_error(out, "indexOf() expects two strings.");
+  }
+
+  size_t haystack_len, needle_len;
+  const char* haystack = string_like_chars(argv[0], &haystack_len);
+  const char* needle = string_like_chars(argv[1], &needle_len);
+
+  const char* found = memmem(haystack, haystack_len, needle, needle_len);
+  *out = NUMBER_VAL(found == NULL ? -1 : (double) (found - haystack));
+  return true;
+}
+
+// startsWith(str, prefix)
+static bool starts_with_native(uint8_t argc, Value* argv, Value* out) {
+  (void) argc;
+
+  if (!is_string_like(argv[0]) || !is_string_like(argv[1])) {
+    return native_error(out, "startsWith() expects two strings.");
+  }
+
+  size_t str_len, prefix_len;
+  const char* str = string_like_chars(argv[0], &str_len);
+  const char* prefix = string_like_chars(argv[1], &prefix_len);
+
+  *out = BOOL_VAL(prefix_len <= str_len && memcmp(str, prefix, prefix_len) == 0);
+  return true;
+}
+
+// split(str, sep, n) returns the n-th field of `str` delimited by `sep`
+// (or nil if there aren't that many fields); there's no list type to
+// return every field at once, so callers walk fields by index
+//
+//     split("a,b,c", ",", 1) // "b"
+//
+static bool split_native(uint8_t argc, Value* argv, Value* out) {
+  (void) argc;
+
+  if (!is_string_like(argv[0]) || !is_string_like(argv[1]) || !IS_NUMBER(argv[2])) {
+    return native_error(out, "split() expects a string, separator and field index.");
+  }
+
+  size_t str_len, sep_len;
+  const char* str = string_like_chars(argv[0], &str_len);
+  const char* sep = string_like_chars(argv[1], &sep_len);
+  if (sep_len == 0) return native_error(out, "split() separator can't be empty.");
+
+  double index = AS_NUMBER(argv[2]);
+  if (isnan(index)) return native_error(out, "split() field index can't be NaN.");
+
+  // (there are at most `str_len + 1` fields)
+  *out = NIL_VAL;
+  if (index < 0 || index > (double) str_len) return true;
+
+  size_t n = (size_t) index;
+  const char* field = str;
+  const char* end = str + str_len;
+
+  for (;;) {
+    const char* next = memmem(field, end - field, sep, sep_len);
+    const char* field_end = next == NULL ? end : next;
+
+    if (n == 0) {
+      *out = slice_of(argv[0], field - str, field_end - field);
+      return true;
+    }
+
+    if (next == NULL) return true; // ran out of fields
+
+    field = next + sep_len;
+    n--;
+  }
+}
+
+// --
+
+#define PURE     NATIVE_PURE
+#define NO_ALLOC NATIVE_NO_ALLOC
+#define INLINE   NATIVE_INTRINSIC
+
+const NativeDef natives[] = {
+/*+----------------+----------------------+-------+------------------------+-----------+
+  | name           | function             | arity | flags                  | intrinsic |
+  +----------------+----------------------+-------+------------------------+-----------+*/
+  {"clock",         clock_native,          0,      NO_ALLOC | INLINE,        OP_CLOCK  },
+  {"memStats",      mem_stats_native,      1,      NO_ALLOC,                 0         },
+  {"heapSnapshot",  heap_snapshot_native,  1,      NO_ALLOC,                 0         },
+  {"sqrt",          sqrt_native,           1,      PURE | NO_ALLOC | INLINE, OP_SQRT   },
+  {"floor",         floor_native,          1,      PURE | NO_ALLOC | INLINE, OP_FLOOR  },
+  {"abs",           abs_native,            1,      PURE | NO_ALLOC | INLINE, OP_ABS    },
+  {"min",           min_native,            2,      PURE | NO_ALLOC | INLINE, OP_MIN    },
+  {"max",           max_native,            2,      PURE | NO_ALLOC | INLINE, OP_MAX    },
+  {"len",           len_native,            1,      PURE | NO_ALLOC,          0         },
+  {"substr",        substr_native,         3,      PURE,                     0         },
+  {"indexOf",       index_of_native,       2,      PURE | NO_ALLOC,          0         },
+  {"startsWith",    starts_with_native,    2,      PURE | NO_ALLOC,          0         },
+  {"split",         split_native,          3,      PURE,                     0         },
+/*+----------------+----------------------+-------+------------------------+-----------+*/
+};
+
+const size_t natives_count = sizeof(natives) / sizeof(NativeDef);
+
+// the compiler tracks natives in 64-bit sets
+_Static_assert(sizeof(natives) / sizeof(NativeDef) <= 64, "too many natives");
+
+#undef PURE
+#undef NO_ALLOC
+#undef INLINE
+
+void define_natives() {
+  // size the tables up front, so registering a large library
+  // doesn't repeatedly rehash them as they grow
+  table_reserve(&vm.globals, vm.globals.len + natives_count);
+  table_reserve(&vm.strings, vm.strings.len + natives_count);
+
+  for (size_t i = 0; i < natives_count; i++) {
+    const NativeDef* def = &natives[i];
+
+    push(OBJ_VAL((Obj*) copy_string(def->name, strlen(def->name))));
+    push(OBJ_VAL((Obj*) new_native(def->function, def->arity, def->flags, (uint16_t) i)));
+    table_set(&vm.globals, vm.stack_top[-2], vm.stack_top[-1]);
+    pop(); // push then pop the values onto the stack to include
+    pop(); // them in garbage collection
+  }
+}
@@ -0,0 +1,29 @@
+#ifndef __CLOX_NATIVES_H__
+#define __CLOX_NATIVES_H__
+
+#include "common.h"
+#include "chunk.h"
+#include "object.h"
+
+/**
+ * Static description of a native function. Every native is listed in
+ * a single table, which is used to register them as globals at startup
+ * and which the compiler consults to inline intrinsics and fold calls
+ * to pure natives.
+ */
+typedef struct {
+  const char* name;
+  NativeFn function;
+  int arity;         // number of arguments, or NATIVE_VARIADIC
+  uint8_t flags;     // NativeFlags
+  OpCode intrinsic;  // op that direct calls compile to (if NATIVE_INTRINSIC)
+} NativeDef;
+
+extern const NativeDef natives[];
+
+extern const size_t natives_count;
+
+// register every native as a global
+void define_natives();
+
+#endif // __CLOX_NATIVES_H__
@@ -0,0 +1,436 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "number.h"
+
+// the largest double is ~2^1024, and scaling it to (or below) 1
+// takes up to 10^324; 40 words leaves plenty of headroom for that
+#define BIGNUM_WORDS 40
+
+#define MAX_SAFE_INTEGER 9007199254740992.0 // 2^53
+#define LOG10_2 0.30102999566398114
+
+/**
+ * Minimal arbitrary-precision unsigned integer, supporting just
+ * enough operations for exact digit generation.
+ *
+ *     [lo][  ][  ]...[hi]  base 2^32 "digits", little-endian
+ */
+typedef struct {
+  uint32_t words[BIGNUM_WORDS];
+  int len; // number of words in use (no leading zero words)
+} Bignum;
+
+static void big_set(Bignum* n, uint64_t val) {
+  n->words[0] = (uint32_t) val;
+  n->words[1] = (uint32_t) (val >> 32);
+  n->len = n->words[1] != 0 ? 2 : (n->words[0] != 0 ? 1 : 0);
+}
+
+static void big_mul_small(Bignum* n, uint32_t factor) {
+  uint64_t carry = 0;
+  for (int i = 0; i < n->len; i++) {
+    uint64_t prod = (uint64_t) n->words[i] * factor + carry;
+    n->words[i] = (uint32_t) prod;
+    carry = prod >> 32;
+  }
+
+  if (carry != 0) n->words[n->len++] = (uint32_t) carry;
+}
+
+static void big_mul_pow10(Bignum* n, int exp) {
+  static const uint32_t pow10[] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000,
+  };
+
+  for (; exp >= 9; exp -= 9) big_mul_small(n, 1000000000);
+  if (exp > 0) big_mul_small(n, pow10[exp]);
+}
+
+static void big_shift_left(Bignum* n, int bits) {
+  if (n->len == 0) return;
+
+  int words = bits / 32;
+  bits %= 32;
+
+  if (bits != 0) {
+    uint32_t carry = 0;
+    for (int i = 0; i < n->len; i++) {
+      uint32_t word = n->words[i];
+      n->words[i] = (word << bits) | carry;
+      carry = word >> (32 - bits);
+    }
+
+    if (carry != 0) n->words[n->len++] = carry;
+  }
+
+  if (words != 0) {
+    memmove(n->words + words, n->words, n->len * sizeof(uint32_t));
+    memset(n->words, 0, words * sizeof(uint32_t));
+    n->len += words;
+  }
+}
+
+static void big_add(Bignum* sum, const Bignum* a, const Bignum* b) {
+  int len = a->len > b->len ? a->len : b->len;
+  uint64_t carry = 0;
+
+  for (int i = 0; i < len; i++) {
+    uint64_t word = carry + (i < a->len ? a->words[i] : 0)
+                          + (i < b->len ? b->words[i] : 0);
+    sum->words[i] = (uint32_t) word;
+    carry = word >> 32;
+  }
+
+  sum->len = len;
+  if (carry != 0) sum->words[sum->len++] = (uint32_t) carry;
+}
+
+// a -= b, where a >= b
+static void big_sub(Bignum* a, const Bignum* b) {
+  int64_t borrow = 0;
+  for (int i = 0; i < a->len; i++) {
+    int64_t diff = (int64_t) a->words[i] - (i < b->len ? b->words[i] : 0) - borrow;
+    borrow = diff < 0;
+    a->words[i] = (uint32_t) diff; // wraps around when borrowing
+  }
+
+  while (a->len > 0 && a->words[a->len - 1] == 0) a->len--;
+}
+
+static int big_cmp(const Bignum* a, const Bignum* b) {
+  if (a->len != b->len) return a->len < b->len ? -1 : 1;
+
+  for (int i = a->len - 1; i >= 0; i--) {
+    if (a->words[i] != b->words[i]) return a->words[i] < b->words[i] ? -1 : 1;
+  }
+
+  return 0;
+}
+
+// whether r + m+ reaches the upper rounding boundary s
+static bool big_reaches(const Bignum* r, const Bignum* m_plus, const Bignum* s, bool inclusive) {
+  Bignum sum;
+  big_add(&sum, r, m_plus);
+  int cmp = big_cmp(&sum, s);
+  return inclusive ? cmp >= 0 : cmp > 0;
+}
+
+// Split a positive, finite double into an integer significand `f`
+// and binary exponent `e`, such that num = f * 2^e.
+//
+// @return true if the gap to the next-lower double is half the gap
+//         to the next-higher one (true for exact powers of 2)
+static bool decompose(double num, uint64_t* f, int* e) {
+  uint64_t bits;
+  memcpy(&bits, &num, sizeof(bits));
+
+  uint64_t frac = bits & ((1ull << 52) - 1);
+  int biased_exp = (int) ((bits >> 52) & 0x7ff);
+
+  if (biased_exp == 0) { // subnormal
+    *f = frac;
+    *e = -1074;
+  } else {
+    *f = frac | (1ull << 52);
+    *e = biased_exp - 1075;
+  }
+
+  return biased_exp > 1 && frac == 0;
+}
+
+// Estimate the decimal exponent k (where num < 10^k) from the binary
+// one; this is either exact or one too low, which callers fix up.
+static int estimate_exp10(uint64_t f, int e) {
+  int bit_len = 64 - __builtin_clzll(f);
+  double estimate = (e + bit_len - 1) * LOG10_2 - 1e-10;
+  int k = (int) estimate;
+  if (estimate > k) k++; // ceil
+  return k;
+}
+
+// Generate the shortest digit string that uniquely identifies `num`
+// (positive and finite), using the "free-format" algorithm from Burger
+// & Dybvig's "Printing Floating-Point Numbers Quickly and Accurately".
+// This produces the same digits as Ryu, exactly, but is backed by a
+// small bignum instead of large tables of precomputed powers.
+//
+// The value is scaled to r/s (with rounding margins m+ and m-) so that
+// digits can be peeled off one at a time, stopping as soon as the
+// digits generated so far fall within half an ulp of `num`.
+//
+//     num = 0.d1 d2 d3 ... * 10^exp
+//
+static int shortest_digits(double num, char* digits, int* exp) {
+  uint64_t f;
+  int e;
+  bool uneven_gap = decompose(num, &f, &e);
+  bool even = (f & 1) == 0; // ties round to even, so the boundaries are inclusive
+
+  Bignum r, s, m_plus, m_minus;
+  big_set(&r, f);
+  big_set(&m_plus, 1);
+  big_set(&m_minus, 1);
+
+  if (e >= 0) {
+    big_shift_left(&r, uneven_gap ? e + 2 : e + 1);
+    big_set(&s, uneven_gap ? 4 : 2);
+    big_shift_left(&m_plus, uneven_gap ? e + 1 : e);
+    big_shift_left(&m_minus, e);
+  } else {
+    big_shift_left(&r, uneven_gap ? 2 : 1);
+    big_set(&s, 1);
+    big_shift_left(&s, uneven_gap ? 2 - e : 1 - e);
+    if (uneven_gap) big_set(&m_plus, 2);
+  }
+
+  int k = estimate_exp10(f, e);
+  if (k >= 0) {
+    big_mul_pow10(&s, k);
+  } else {
+    big_mul_pow10(&r, -k);
+    big_mul_pow10(&m_plus, -k);
+    big_mul_pow10(&m_minus, -k);
+  }
+
+  if (big_reaches(&r, &m_plus, &s, even)) {
+    big_mul_small(&s, 10);
+    k++;
+  }
+
+  int len = 0;
+  for (;;) {
+    big_mul_small(&r, 10);
+    big_mul_small(&m_plus, 10);
+    big_mul_small(&m_minus, 10);
+
+    int digit = 0;
+    while (big_cmp(&r, &s) >= 0) { // r < 10s, so this runs at most 9 times
+      big_sub(&r, &s);
+      digit++;
+    }
+
+    int low_cmp = big_cmp(&r, &m_minus);
+    bool low = even ? low_cmp <= 0 : low_cmp < 0;
+    bool high = big_reaches(&r, &m_plus, &s, even);
+
+    if (!low && !high) {
+      digits[len++] = '0' + digit;
+      continue;
+    }
+
+    if (low && high) { // either works, so pick whichever is closer
+      Bignum twice = r;  // (or the even one, if it's an exact tie)
+      big_shift_left(&twice, 1);
+      int cmp = big_cmp(&twice, &s);
+      if (cmp > 0 || (cmp == 0 && digit % 2 == 1)) digit++;
+    } else if (high) {
+      digit++;
+    }
+
+    digits[len++] = '0' + digit;
+    break;
+  }
+
+  *exp = k;
+  return len;
+}
+
+// Same algorithm as `shortest_digits`, for numbers whose scaled
+// values all fit in 128 bits (binary exponents within roughly
+// [-100, 10], which covers magnitudes from ~1e-15 to ~1e19). This is
+// the common case, and skips the bignum loops entirely.
+static int shortest_digits_small(double num, char* digits, int* exp) {
+  static const uint64_t pow10[] = {
+    1ull, 10ull, 100ull, 1000ull, 10000ull, 100000ull, 1000000ull,
+    10000000ull, 100000000ull, 1000000000ull, 10000000000ull,
+    100000000000ull, 1000000000000ull, 10000000000000ull,
+    100000000000000ull, 1000000000000000ull, 10000000000000000ull,
+    100000000000000000ull, 1000000000000000000ull, 10000000000000000000ull,
+  };
+
+  uint64_t f;
+  int e;
+  bool uneven_gap = decompose(num, &f, &e);
+  bool even = (f & 1) == 0;
+
+  unsigned __int128 r, s, m_plus, m_minus;
+  if (e >= 0) {
+    r = (unsigned __int128) f << (uneven_gap ? e + 2 : e + 1);
+    s = uneven_gap ? 4 : 2;
+    m_plus = (unsigned __int128) 1 << (uneven_gap ? e + 1 : e);
+    m_minus = (unsigned __int128) 1 << e;
+  } else {
+    r = (unsigned __int128) f << (uneven_gap ? 2 : 1);
+    s = (unsigned __int128) 1 << (uneven_gap ? 2 - e : 1 - e);
+    m_plus = uneven_gap ? 2 : 1;
+    m_minus = 1;
+  }
+
+  int k = estimate_exp10(f, e);
+  if (k >= 0) {
+    s *= pow10[k];
+  } else {
+    r *= pow10[-k];
+    m_plus *= pow10[-k];
+    m_minus *= pow10[-k];
+  }
+
+  if (even ? r + m_plus >= s : r + m_plus > s) {
+    s *= 10;
+    k++;
+  }
+
+  int len = 0;
+  for (;;) {
+    r *= 10;
+    m_plus *= 10;
+    m_minus *= 10;
+
+    int digit = (int) (r / s);
+    r %= s;
+
+    bool low = even ? r <= m_minus : r < m_minus;
+    bool high = even ? r + m_plus >= s : r + m_plus > s;
+
+    if (!low && !high) {
+      digits[len++] = '0' + digit;
+      continue;
+    }
+
+    if (low && high) {
+      if (r * 2 > s || (r * 2 == s && digit % 2 == 1)) digit++;
+    } else if (high) {
+      digit++;
+    }
+
+    digits[len++] = '0' + digit;
+    break;
+  }
+
+  *exp = k;
+  return len;
+}
+
+static size_t write_uint(uint64_t n, char* buf) {
+  char tmp[20];
+  size_t len = 0;
+
+  do {
+    tmp[len++] = '0' + (n % 10);
+    n /= 10;
+  } while (n != 0);
+
+  for (size_t i = 0; i < len; i++) {
+    buf[i] = tmp[len - 1 - i];
+  }
+
+  return len;
+}
+
+size_t format_number(double num, char* buf) {
+  char* p = buf;
+
+  if (isnan(num)) {
+    memcpy(p, "nan", 3);
+    return 3;
+  }
+
+  if (signbit(num)) {
+    *p++ = '-';
+    num = -num;
+  }
+
+  if (isinf(num)) {
+    memcpy(p, "inf", 3);
+    return (p - buf) + 3;
+  }
+
+  // fast path: most numbers in practice are whole, so skip
+  // digit generation and write them out as integers
+  if (num < MAX_SAFE_INTEGER && num == (double) (uint64_t) num) {
+    return (p - buf) + write_uint((uint64_t) num, p);
+  }
+
+  char digits[20];
+  int k;
+  int len = num > 1e-15 && num < 1e19 ? shortest_digits_small(num, digits, &k)
+                                       : shortest_digits(num, digits, &k);
+  int exp = k - 1; // exponent in scientific notation (d.ddd * 10^exp)
+
+  if (exp < -4 || exp >= 17) { // d.ddde+XX (same cutoffs as %.17g)
+    *p++ = digits[0];
+    if (len > 1) {
+      *p++ = '.';
+      memcpy(p, digits + 1, len - 1);
+      p += len - 1;
+    }
+
+    *p++ = 'e';
+    *p++ = exp < 0 ? '-' : '+';
+    if (exp < 0) exp = -exp;
+    if (exp < 10) *p++ = '0';
+    p += write_uint((uint64_t) exp, p);
+  } else if (k <= 0) {         // 0.000ddd
+    *p++ = '0';
+    *p++ = '.';
+    memset(p, '0', -k);
+    p += -k;
+    memcpy(p, digits, len);
+    p += len;
+  } else if (len <= k) {       // ddd000 (too large for the fast path)
+    memcpy(p, digits, len);
+    p += len;
+    memset(p, '0', k - len);
+    p += k - len;
+  } else {                     // ddd.ddd
+    memcpy(p, digits, k);
+    p += k;
+    *p++ = '.';
+    memcpy(p, digits + k, len - k);
+    p += len - k;
+  }
+
+  return p - buf;
+}
+
+// If both the digits (as an integer) and the power of ten they're
+// scaled by are exactly representable as doubles, then a single
+// division is correctly rounded (see Clinger, "How to Read Floating
+// Point Numbers Accurately"). That covers nearly every literal in
+// real code; anything longer falls back to strtod.
+double parse_number(const char* chars, size_t len) {
+  static const double pow10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+  };
+
+  uint64_t mantissa = 0;
+  int frac_digits = 0;
+  bool in_frac = false;
+
+  for (size_t i = 0; i < len; i++) {
+    char c = chars[i];
+    if (c == '.') {
+      in_frac = true;
+      continue;
+    }
+
+    if (mantissa > (UINT64_MAX - 9) / 10) return strtod(chars, NULL);
+
+    mantissa = mantissa * 10 + (c - '0');
+    if (in_frac) frac_digits++;
+  }
+
+  if (mantissa > (uint64_t) MAX_SAFE_INTEGER || frac_digits > 22) {
+    return strtod(chars, NULL);
+  }
+
+  return (double) mantissa / pow10[frac_digits];
+}
+
+// ---
+
+#undef BIGNUM_WORDS
+#undef MAX_SAFE_INTEGER
+#undef LOG10_2
@@ -0,0 +1,27 @@
+#ifndef __CLOX_NUMBER_H__
+#define __CLOX_NUMBER_H__
+
+#include "common.h"
+
+// large enough for any formatted double, e.g. "-2.2250738585072014e-308"
+#define NUMBER_BUF_MAX 32
+
+/**
+ * Format a number using the fewest digits that will still parse
+ * back to exactly the same double (shortest round-trip). Whole
+ * numbers are written as plain integers.
+ *
+ * The output is written to `buf` (which should have room for at
+ * least NUMBER_BUF_MAX bytes) and is *not* null-terminated.
+ *
+ * @return the number of bytes written
+ */
+size_t format_number(double num, char* buf);
+
+/**
+ * Parse a decimal number literal, as produced by the scanner
+ * (one or more digits, optionally followed by a fractional part).
+ */
+double parse_number(const char* chars, size_t len);
+
+#endif // __CLOX_NUMBER_H__
@@ -1,7 +1,10 @@
 #include <stdio.h>
 #include <string.h>
+#include "gc.h"
+#include "heap_profile.h"
 #include "logger.h"
 #include "memory.h"
+#include "mem_stats.h"
 #include "object.h"
 #include "table.h"
 #include "vm.h"
@@ -9,13 +12,36 @@
 #define ALLOCATE_OBJ(type, obj_type) \
   ((type*) allocate_object(sizeof(type), obj_type))
 
+const char* obj_type_names[OBJ_TYPE_COUNT] = {
+  [OBJ_CLOSURE]  = "closure",
+  [OBJ_FUNCTION] = "function",
+  [OBJ_NATIVE]   = "native",
+  [OBJ_SLICE]    = "slice",
+  [OBJ_STRING]   = "string",
+  [OBJ_UPVALUE]  = "upvalue",
+};
+
+// Objects start out in the nursery. If it's full, they're allocated
+// straight into the old generation until the next minor collection.
 static Obj* allocate_object(size_t size, ObjType type) {
-  Obj* obj = (Obj*) reallocate(NULL, 0, size);
-  obj->type = type;
+  Obj* obj = nursery_allocate(size);
 
-  // prepend to `vm.objects` linked list
-  obj->next = vm.objects;
-  vm.objects = obj;
+  if (obj != NULL) {
+    obj->header = 0; // young objects aren't linked into `vm.objects`
+  } else {
+    obj = old_allocate(size);
+  }
+
+  // (unmarked, and not remembered)
+  obj->header = (obj->header & OBJ_NEXT_MASK) | ((uint64_t) type << OBJ_TYPE_SHIFT);
+
+  if (!IS_YOUNG(obj)) track_old_object(obj);
+  count_allocation(type, size);
+  if (vm.heap_sample > 0) profile_allocation(size, 1);
+
+#ifdef DEBUG_LOG_GC
+  fprintf(stderr, "%p allocate %zu for type %d\n", (void*) obj, size, type);
+#endif
 
   return obj;
 }
@@ -25,14 +51,19 @@ static ObjString* allocate_string(char* chars, size_t len, uint32_t hash) {
   str->len = len;
   str->chars = chars;
   str->hash = hash;
+  count_payload(OBJ_STRING, len + 1);
+  if (vm.heap_sample > 0) profile_allocation(len + 1, 0);
 
-  // intern the string
-  table_set(&vm.strings, str, NIL_VAL);
+  // intern the string (growing the table may trigger a
+  // collection, so make sure the new string is reachable)
+  push(OBJ_VAL((Obj*) str));
+  table_set(&vm.strings, OBJ_VAL((Obj*) str), NIL_VAL);
+  pop();
 
   return str;
 }
 
-static uint32_t hash_string(const char* chars, size_t len) {
+uint32_t hash_string(const char* chars, size_t len) {
   uint32_t hash = 2166136261u; // base for FNV-1a
 
   for (size_t i = 0; i < len; i++) {
@@ -45,6 +76,7 @@ static uint32_t hash_string(const char* chars, size_t len) {
 
 ObjClosure* new_closure(ObjFunction* func) {
   ObjUpvalue** uvs = ALLOCATE(ObjUpvalue*, func->upvalue_count);
+  count_payload(OBJ_CLOSURE, sizeof(ObjUpvalue*) * func->upvalue_count);
   for (int i = 0; i < func->upvalue_count; i++) {
     uvs[i] = NULL;
   }
@@ -67,16 +99,37 @@ ObjFunction* new_function() {
   return func;
 }
 
-ObjNative* new_native(NativeFn func) {
+ObjNative* new_native(NativeFn func, int arity, uint8_t flags, uint16_t id) {
   ObjNative* native = ALLOCATE_OBJ(ObjNative, OBJ_NATIVE);
   native->function = func;
+  native->arity = arity;
+  native->flags = flags;
+  native->id = id;
   return native;
 }
 
+ObjSlice* new_slice(ObjString* parent, size_t offset, size_t len) {
+  ObjSlice* slice = ALLOCATE_OBJ(ObjSlice, OBJ_SLICE);
+  slice->parent = parent;
+  slice->offset = offset;
+  slice->len = len;
+  return slice;
+}
+
+// The intern table doesn't keep strings alive, so while an incremental
+// collection is marking, a string that's looked up may be one that hasn't
+// been reached (yet, or at all). Handing it back makes it reachable again,
+// so it has to be marked, just like the write barrier does for stores.
+static ObjString* find_interned(const char* chars, size_t len, uint32_t hash) {
+  ObjString* interned = table_find_string(&vm.strings, chars, len, hash);
+  if (interned != NULL && vm.gc_state == GC_MARKING) mark_object((Obj*) interned);
+  return interned;
+}
+
 ObjString* take_string(char* chars, size_t len) {
   uint32_t hash = hash_string(chars, len);
 
-  ObjString* interned = table_find_string(&vm.strings, chars, len, hash);
+  ObjString* interned = find_interned(chars, len, hash);
   if (interned != NULL) {
     FREE_ARRAY(char, chars, len + 1); // if the we're using the interned copy, it's
     return interned;                  // up to us to free the memory used by `chars`
@@ -89,7 +142,7 @@ ObjString* copy_string(const char* chars, size_t len) {
   uint32_t hash = hash_string(chars, len);
 
   // if the string's already been interned, return that
-  ObjString* interned = table_find_string(&vm.strings, chars, len, hash);
+  ObjString* interned = find_interned(chars, len, hash);
   if (interned != NULL) return interned;
 
   char* heap_chars = ALLOCATE(char, len + 1);
@@ -127,6 +180,11 @@ void print_object(Value val) {
     case OBJ_NATIVE:
       out_printf("<native fn>");
       break;
+    case OBJ_SLICE: {
+      ObjSlice* slice = AS_SLICE(val);
+      out_printf("%.*s", (int) slice->len, slice->parent->chars + slice->offset);
+      break;
+    }
     case OBJ_STRING:
       out_printf("%s", AS_CSTRING(val));
       break;
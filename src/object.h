@@ -5,16 +5,18 @@
 #include "chunk.h"
 #include "value.h"
 
-#define OBJ_TYPE(val)     (AS_OBJ(val)->type)
+#define OBJ_TYPE(val)     obj_type(AS_OBJ(val))
 
 #define IS_CLOSURE(val)   is_obj_type(val, OBJ_CLOSURE)
 #define IS_FUNCTION(val)  is_obj_type(val, OBJ_FUNCTION)
 #define IS_NATIVE(val)    is_obj_type(val, OBJ_NATIVE)
+#define IS_SLICE(val)     is_obj_type(val, OBJ_SLICE)
 #define IS_STRING(val)    is_obj_type(val, OBJ_STRING)
 
 #define AS_CLOSURE(val)   ((ObjClosure*) AS_OBJ(val))
 #define AS_FUNCTION(val)  ((ObjFunction*) AS_OBJ(val))
-#define AS_NATIVE(val)    (((ObjNative*) AS_OBJ(val))->function)
+#define AS_NATIVE(val)    ((ObjNative*) AS_OBJ(val))
+#define AS_SLICE(val)     ((ObjSlice*) AS_OBJ(val))
 #define AS_STRING(val)    ((ObjString*) AS_OBJ(val))
 #define AS_CSTRING(val)   (((ObjString*) AS_OBJ(val))->chars)
 
@@ -22,19 +24,25 @@ typedef enum {
   OBJ_CLOSURE,
   OBJ_FUNCTION,
   OBJ_NATIVE,
+  OBJ_SLICE,
   OBJ_STRING,
   OBJ_UPVALUE,
 } ObjType;
 
+#define OBJ_TYPE_COUNT (OBJ_UPVALUE + 1)
+
+// (for reports, e.g. "closure")
+extern const char* obj_type_names[OBJ_TYPE_COUNT];
+
 /**
  * Obj serves as the "base class" for all object "subclasses",
  * which in turn "inherit" from it. Since C doesn't actually
  * support direct OOP, this is simulated by using a common
  * struct layout for all "subclasses", with a type header.
  *
- *     [ ][ ][ ][ ] [ ][ ][ ][ ]...
- *     |-- type --| |-------------->
- *        header     subclass fields
+ *     [ ][ ][ ][ ][ ][ ][ ][ ] [ ][ ][ ][ ]...
+ *     |-------- header -------| |--------------->
+ *                                subclass fields
  *
  * Additionally, C guarantees that the first field of a struct
  * will always be the first in memory, so it's safe to convert
@@ -48,10 +56,67 @@ typedef enum {
  *     ObjString* obj_str = (ObjString*) obj;
  */
 struct Obj {
-  ObjType type;
-  struct Obj* next; // track usage for naive garbage collection
+  uint64_t header; // (see below)
 };
 
+/**
+ * The header packs everything the VM and GC need to know about an
+ * object into a single word, since user-space pointers only use the
+ * low 48 bits (on x86-64 and arm64):
+ *
+ *      63    58  57  56  55      48 47                            0
+ *     [ - - - ][R ][M ][   type   ][             next             ]
+ *
+ * - next: the next object on its `vm.objects` list, for the GC to
+ *   sweep (young objects use this as a forwarding pointer instead)
+ * - type: the object's ObjType
+ * - M: reachable as of the last GC mark phase
+ * - R: in the write barrier's remembered set
+ *
+ * (which generation an object is in follows from its address, see
+ * IS_YOUNG)
+ */
+#define OBJ_NEXT_MASK       ((UINT64_C(1) << 48) - 1)
+#define OBJ_TYPE_SHIFT      48
+#define OBJ_MARKED_BIT      (UINT64_C(1) << 56)
+#define OBJ_REMEMBERED_BIT  (UINT64_C(1) << 57)
+
+static inline ObjType obj_type(Obj* obj) {
+  return (ObjType) ((obj->header >> OBJ_TYPE_SHIFT) & 0xff);
+}
+
+// (for when parallel markers may be setting the mark bit in the same
+// word, see `mark_slot_atomic`; a relaxed load is still a plain load)
+static inline ObjType obj_type_atomic(Obj* obj) {
+  return (ObjType) ((__atomic_load_n(&obj->header, __ATOMIC_RELAXED) >> OBJ_TYPE_SHIFT) & 0xff);
+}
+
+static inline Obj* obj_next(Obj* obj) {
+  return (Obj*) (uintptr_t) (obj->header & OBJ_NEXT_MASK);
+}
+
+static inline void set_obj_next(Obj* obj, Obj* next) {
+  obj->header = (obj->header & ~OBJ_NEXT_MASK) | (uint64_t) (uintptr_t) next;
+}
+
+static inline bool is_marked(Obj* obj) {
+  return (obj->header & OBJ_MARKED_BIT) != 0;
+}
+
+static inline void set_marked(Obj* obj, bool marked) {
+  if (marked) obj->header |= OBJ_MARKED_BIT;
+  else        obj->header &= ~OBJ_MARKED_BIT;
+}
+
+static inline bool is_remembered(Obj* obj) {
+  return (obj->header & OBJ_REMEMBERED_BIT) != 0;
+}
+
+static inline void set_remembered(Obj* obj, bool remembered) {
+  if (remembered) obj->header |= OBJ_REMEMBERED_BIT;
+  else            obj->header &= ~OBJ_REMEMBERED_BIT;
+}
+
 typedef struct {
   Obj obj;
   Chunk chunk;
@@ -62,11 +127,27 @@ typedef struct {
   int upvalue_count; // how many upvalues are captured
 } ObjFunction;
 
-typedef Value (*NativeFn)(uint8_t argc, Value* argv);
+// Natives write their return value to `out` and return true, or write
+// an error message (string) to `out` and return false to signal a
+// runtime error.
+typedef bool (*NativeFn)(uint8_t argc, Value* argv, Value* out);
+
+#define NATIVE_VARIADIC -1 // arity for natives accepting any no. of args
+
+typedef enum {
+  NATIVE_PURE      = 1 << 0, // result depends only on the arguments, and there
+                             // are no side effects (calls may be constant-folded)
+  NATIVE_NO_ALLOC  = 1 << 1, // never allocates (outside of error messages), so
+                             // folded calls needn't root their arguments
+  NATIVE_INTRINSIC = 1 << 2, // direct calls compile to a dedicated op
+} NativeFlags;
 
 typedef struct {
   Obj obj;
   NativeFn function;
+  int arity;     // checked by the VM before each call
+  uint8_t flags; // NativeFlags
+  uint16_t id;   // index into the `natives` registry
 } ObjNative;
 
 struct ObjString {
@@ -77,6 +158,22 @@ struct ObjString {
   uint32_t hash; // eagerly-computed hash
 };
 
+// A slice is a read-only view into part of a parent string, so
+// that taking a substring doesn't need to copy (or intern) anything.
+// Slices always point at the original string, never at another slice,
+// so slicing a slice just adjusts the offset.
+//
+//     parent  [h][e][l][l][o][,][ ][w][o][r][l][d]
+//                                   |-- len --|
+//     slice   offset = 7, len = 5   "world"
+//
+typedef struct {
+  Obj obj;
+  ObjString* parent;
+  size_t offset;
+  size_t len;
+} ObjSlice;
+
 typedef struct ObjUpvalue {
   Obj obj;
   Value* location; // reference to the captured variable; note that
@@ -104,12 +201,17 @@ ObjClosure* new_closure(ObjFunction* func);
 
 ObjFunction* new_function();
 
-ObjNative* new_native(NativeFn func);
+ObjNative* new_native(NativeFn func, int arity, uint8_t flags, uint16_t id);
+
+ObjSlice* new_slice(ObjString* parent, size_t offset, size_t len);
 
 ObjString* take_string(char* chars, size_t len);
 
 ObjString* copy_string(const char* chars, size_t len);
 
+/** @return the hash an interned string with these characters would have */
+uint32_t hash_string(const char* chars, size_t len);
+
 ObjUpvalue* new_upvalue(Value* slot);
 
 void print_object(Value val);
@@ -118,4 +220,21 @@ static inline bool is_obj_type(Value val, ObjType type) {
   return IS_OBJ(val) && OBJ_TYPE(val) == type;
 }
 
+// strings and slices can be used interchangeably by most operations
+static inline bool is_string_like(Value val) {
+  return IS_STRING(val) || IS_SLICE(val);
+}
+
+/** @return the (not null-terminated) characters of a string or slice */
+static inline const char* string_like_chars(Value val, size_t* len) {
+  if (IS_SLICE(val)) {
+    ObjSlice* slice = AS_SLICE(val);
+    *len = slice->len;
+    return slice->parent->chars + slice->offset;
+  }
+
+  *len = AS_STRING(val)->len;
+  return AS_CSTRING(val);
+}
+
 #endif // __CLOX_OBJECT_H__
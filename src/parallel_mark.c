@@ -0,0 +1,331 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include "gc.h"
+#include "memory.h"
+#include "object.h"
+#include "parallel_mark.h"
+#include "vm.h"
+
+// capacity of each worker's deque (must be a power of two)
+#define DEQUE_SIZE 4096
+
+/**
+ * Each marking thread owns a work-stealing deque of gray objects
+ * (Chase & Lev, "Dynamic Circular Work-Stealing Deque"). The owner
+ * pushes and pops objects at the bottom, without contention in the
+ * common case, while idle threads steal from the top.
+ *
+ *            top                 bottom
+ *             v                    v
+ *     [ ][ ][a][b][c][d][e][ ][ ][ ]
+ *             ^                 ^
+ *          stolen           popped/pushed
+ *         by thieves        by the owner
+ *
+ * The deque doesn't grow. When it's full, the owner keeps any extra
+ * gray objects on a private overflow stack, and moves them back into
+ * the deque (where others can steal them) once it's drained.
+ *
+ * Mark bits are set with an atomic exchange, so exactly one thread
+ * wins the race to mark (and so trace) any given object. The losers
+ * still write to the header, so the marker threads only ever read it
+ * atomically (the type too, see `visit_references`).
+ */
+typedef struct {
+  atomic_long top;
+  char pad_top[64 - sizeof(atomic_long)]; // (keep the ends of the deque
+  atomic_long bottom;                     // on separate cache lines)
+  char pad_bottom[64 - sizeof(atomic_long)];
+
+  _Atomic(Obj*) items[DEQUE_SIZE];
+
+  ObjStack overflow;    // private to the owner
+  unsigned int seed;    // for picking which worker to steal from
+  unsigned long epoch;  // the last round of marking this worker joined
+  pthread_t thread;
+} Worker;
+
+static struct {
+  Worker* workers; // workers[0] is the thread that kicks off marking
+  int     count;   // (0 until the pool is started)
+
+  pthread_mutex_t lock;
+  pthread_cond_t  start; // signaled when a new round of marking begins
+  pthread_cond_t  done;  // signaled when a helper finishes its round
+  unsigned long   epoch; // incremented for every round of marking
+  int             finished;
+  bool            quit;
+
+  atomic_int active; // workers that may still have gray objects
+} pool = {
+  .lock  = PTHREAD_MUTEX_INITIALIZER,
+  .start = PTHREAD_COND_INITIALIZER,
+  .done  = PTHREAD_COND_INITIALIZER,
+};
+
+static _Thread_local Worker* self;
+
+// -- deque operations
+
+static void overflow_push(Worker* w, Obj* obj) {
+  ObjStack* stack = &w->overflow;
+  if (stack->count == stack->cap) {
+    stack->cap = GROW_CAPACITY(stack->cap);
+    stack->items = realloc(stack->items, sizeof(Obj*) * stack->cap);
+    if (stack->items == NULL) exit(1);
+  }
+
+  stack->items[stack->count++] = obj;
+}
+
+// (owner only)
+static void deque_push(Worker* w, Obj* obj) {
+  long b = atomic_load_explicit(&w->bottom, memory_order_relaxed);
+  long t = atomic_load_explicit(&w->top, memory_order_acquire);
+
+  if (b - t >= DEQUE_SIZE) {
+    overflow_push(w, obj);
+    return;
+  }
+
+  atomic_store_explicit(&w->items[b & (DEQUE_SIZE - 1)], obj, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  atomic_store_explicit(&w->bottom, b + 1, memory_order_relaxed);
+}
+
+// (owner only)
+static Obj* deque_take(Worker* w) {
+  long b = atomic_load_explicit(&w->bottom, memory_order_relaxed) - 1;
+  atomic_store_explicit(&w->bottom, b, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+  long t = atomic_load_explicit(&w->top, memory_order_relaxed);
+
+  if (t > b) { // empty
+    atomic_store_explicit(&w->bottom, b + 1, memory_order_relaxed);
+    return NULL;
+  }
+
+  Obj* obj = atomic_load_explicit(&w->items[b & (DEQUE_SIZE - 1)], memory_order_relaxed);
+
+  if (t == b) { // last item, so race any thieves for it
+    if (!atomic_compare_exchange_strong_explicit(&w->top, &t, t + 1,
+                                                 memory_order_seq_cst,
+                                                 memory_order_relaxed)) {
+      obj = NULL; // lost
+    }
+    atomic_store_explicit(&w->bottom, b + 1, memory_order_relaxed);
+  }
+
+  return obj;
+}
+
+// (any thread)
+static Obj* deque_steal(Worker* w) {
+  long t = atomic_load_explicit(&w->top, memory_order_acquire);
+  atomic_thread_fence(memory_order_seq_cst);
+  long b = atomic_load_explicit(&w->bottom, memory_order_acquire);
+
+  if (t >= b) return NULL; // empty
+
+  Obj* obj = atomic_load_explicit(&w->items[t & (DEQUE_SIZE - 1)], memory_order_relaxed);
+  if (!atomic_compare_exchange_strong_explicit(&w->top, &t, t + 1,
+                                               memory_order_seq_cst,
+                                               memory_order_relaxed)) {
+    return NULL; // lost the race to another thief (or the owner)
+  }
+
+  return obj;
+}
+
+static bool looks_empty(Worker* w) {
+  return atomic_load_explicit(&w->top, memory_order_relaxed) >=
+         atomic_load_explicit(&w->bottom, memory_order_relaxed);
+}
+
+// -- marking
+
+static void mark_slot_atomic(Obj** slot) {
+  Obj* obj = *slot;
+  if (obj == NULL || IS_YOUNG(obj)) return; // (see `mark_object`)
+
+  // check before exchanging, since most references are to objects
+  // that have already been marked, and a load is cheaper
+  if (__atomic_load_n(&obj->header, __ATOMIC_RELAXED) & OBJ_MARKED_BIT) return;
+  if (__atomic_fetch_or(&obj->header, OBJ_MARKED_BIT, __ATOMIC_RELAXED) & OBJ_MARKED_BIT) return;
+
+  deque_push(self, obj);
+}
+
+static Obj* steal_any(Worker* w) {
+  int start = rand_r(&w->seed) % pool.count;
+
+  for (int i = 0; i < pool.count; i++) {
+    Worker* victim = &pool.workers[(start + i) % pool.count];
+    if (victim == w) continue;
+
+    Obj* obj = deque_steal(victim);
+    if (obj != NULL) return obj;
+  }
+
+  return NULL;
+}
+
+static bool any_work_left() {
+  for (int i = 0; i < pool.count; i++) {
+    if (!looks_empty(&pool.workers[i])) return true;
+  }
+
+  return false;
+}
+
+// Trace objects from this worker's deque, stealing from the others
+// once it runs dry, until every worker is out of work. A worker only
+// goes idle once its own deque and overflow stack are empty, and only
+// an active worker can push new objects, so once no workers are
+// active, no deque can ever be refilled and marking is done.
+static void mark_until_done(Worker* w) {
+  self = w;
+
+  for (;;) {
+    Obj* obj = deque_take(w);
+
+    if (obj == NULL && w->overflow.count > 0) {
+      // share the overflow, by moving (up to) half a deque's worth back
+      for (int i = 0; i < DEQUE_SIZE / 2 && w->overflow.count > 0; i++) {
+        deque_push(w, w->overflow.items[--w->overflow.count]);
+      }
+      continue;
+    }
+
+    if (obj == NULL) obj = steal_any(w);
+
+    if (obj != NULL) {
+      visit_references(obj, mark_slot_atomic);
+      continue;
+    }
+
+    // out of work, so wait for either some to turn up, or for everyone
+    // else to run out as well
+    atomic_fetch_sub(&pool.active, 1);
+
+    for (;;) {
+      if (atomic_load(&pool.active) == 0) return;
+
+      if (any_work_left()) {
+        atomic_fetch_add(&pool.active, 1);
+        break;
+      }
+
+      sched_yield();
+    }
+  }
+}
+
+static void* helper_main(void* arg) {
+  Worker* w = (Worker*) arg;
+
+  pthread_mutex_lock(&pool.lock);
+
+  for (;;) {
+    while (pool.epoch == w->epoch && !pool.quit) {
+      pthread_cond_wait(&pool.start, &pool.lock);
+    }
+
+    if (pool.quit) break;
+    w->epoch = pool.epoch;
+
+    pthread_mutex_unlock(&pool.lock);
+    mark_until_done(w);
+    pthread_mutex_lock(&pool.lock);
+
+    pool.finished++;
+    pthread_cond_signal(&pool.done);
+  }
+
+  pthread_mutex_unlock(&pool.lock);
+  return NULL;
+}
+
+static void start_mark_workers(int count) {
+  pool.workers = (Worker*) calloc(count, sizeof(Worker));
+  if (pool.workers == NULL) exit(1);
+
+  pool.count = count;
+  pool.quit = false;
+
+  for (int i = 0; i < count; i++) {
+    pool.workers[i].seed = i + 1;
+    pool.workers[i].epoch = pool.epoch;
+  }
+
+  // (workers[0] is the calling thread)
+  for (int i = 1; i < count; i++) {
+    if (pthread_create(&pool.workers[i].thread, NULL, helper_main, &pool.workers[i]) != 0) {
+      pool.count = i; // make do with what we have
+      break;
+    }
+  }
+}
+
+void parallel_trace_references() {
+  if (pool.count == 0) {
+    int count = vm.gc_threads;
+    if (count > MARK_THREADS_MAX) count = MARK_THREADS_MAX;
+    start_mark_workers(count);
+  }
+
+  // deal out the gray objects (the helpers are all waiting for the next
+  // round, so it's safe to push onto their deques from here)
+  for (int i = 0; i < pool.count; i++) {
+    atomic_store(&pool.workers[i].top, 0);
+    atomic_store(&pool.workers[i].bottom, 0);
+  }
+
+  for (size_t i = 0; i < vm.gray.count; i++) {
+    deque_push(&pool.workers[i % pool.count], vm.gray.items[i]);
+  }
+  vm.gray.count = 0;
+
+  atomic_store(&pool.active, pool.count);
+
+  pthread_mutex_lock(&pool.lock);
+  pool.finished = 0;
+  pool.epoch++;
+  pthread_cond_broadcast(&pool.start);
+  pthread_mutex_unlock(&pool.lock);
+
+  mark_until_done(&pool.workers[0]);
+
+  pthread_mutex_lock(&pool.lock);
+  while (pool.finished < pool.count - 1) {
+    pthread_cond_wait(&pool.done, &pool.lock);
+  }
+  pthread_mutex_unlock(&pool.lock);
+}
+
+void stop_mark_workers() {
+  if (pool.count == 0) return;
+
+  pthread_mutex_lock(&pool.lock);
+  pool.quit = true;
+  pthread_cond_broadcast(&pool.start);
+  pthread_mutex_unlock(&pool.lock);
+
+  for (int i = 1; i < pool.count; i++) {
+    pthread_join(pool.workers[i].thread, NULL);
+  }
+
+  for (int i = 0; i < pool.count; i++) {
+    free(pool.workers[i].overflow.items);
+  }
+
+  free(pool.workers);
+  pool.workers = NULL;
+  pool.count = 0;
+}
+
+// ---
+
+#undef DEQUE_SIZE
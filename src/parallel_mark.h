@@ -0,0 +1,20 @@
+#ifndef __CLOX_PARALLEL_MARK_H__
+#define __CLOX_PARALLEL_MARK_H__
+
+#include "common.h"
+
+// the most threads that can be used for marking (including the main one)
+#define MARK_THREADS_MAX 64
+
+/**
+ * Trace everything reachable from the gray stack, splitting the work
+ * between `vm.gc_threads` threads (the calling thread, plus a pool of
+ * helpers that's started the first time it's needed). Returns once
+ * every reachable object has been marked, leaving the gray stack empty.
+ */
+void parallel_trace_references();
+
+/** Stop the helper threads (if they were ever started). */
+void stop_mark_workers();
+
+#endif // __CLOX_PARALLEL_MARK_H__
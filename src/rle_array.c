@@ -1,11 +1,14 @@
 #include <assert.h>
 #include <stdio.h>
+#include <string.h>
+#include "arena.h"
 #include "rle_array.h"
 
 void init_rle_array(RLEArray* arr) {
   arr->data = NULL;
   arr->cap = 0;
   arr->len = 0;
+  arr->arena = NULL;
 }
 
 void init_rle_tuple(RLETuple* tup, int val) {
@@ -26,7 +29,7 @@ void push_rle_array(RLEArray* arr, int val) {
   if (arr->len == arr->cap) {
     size_t old_cap = arr->cap;
     arr->cap = GROW_CAPACITY(old_cap);
-    arr->data = GROW_ARRAY(RLETuple, arr->data, old_cap, arr->cap);
+    arr->data = GROW_ARRAY_IN(arr->arena, RLETuple, arr->data, old_cap, arr->cap);
   }
 
   init_rle_tuple(&arr->data[arr->len], val);
@@ -41,14 +44,38 @@ int get_nth_rle_array(RLEArray* arr, size_t n) {
   for (size_t offset = 0; offset < arr->len; offset++) {
     tup = &arr->data[offset];
 
-    if (n <= tup->count) return tup->value;
+    if (n < tup->count) return tup->value;
     n -= tup->count;
   }
 
   assert(false && "unreachable (who needs bounds checks)");
 }
 
+void truncate_rle_array(RLEArray* arr, size_t n) {
+  while (n > 0 && arr->len > 0) {
+    RLETuple* last = &arr->data[arr->len - 1];
+    if (last->count > n) {
+      last->count -= n;
+      return;
+    }
+
+    n -= last->count; // drop the whole run
+    arr->len--;
+  }
+}
+
+void seal_rle_array(RLEArray* arr) {
+  if (arr->arena == NULL) return;
+
+  RLETuple* data = ALLOCATE(RLETuple, arr->len);
+  if (arr->len > 0) memcpy(data, arr->data, sizeof(RLETuple) * arr->len);
+
+  arr->data = data;
+  arr->cap = arr->len;
+  arr->arena = NULL;
+}
+
 void free_rle_array(RLEArray* arr) {
-  FREE_ARRAY(RLETuple, arr->data, arr->cap);
+  if (arr->arena == NULL) FREE_ARRAY(RLETuple, arr->data, arr->cap);
   init_rle_array(arr);
 }
@@ -3,6 +3,8 @@
 
 #include "memory.h"
 
+typedef struct Arena Arena;
+
 typedef struct {
   size_t count; // the number of consecutives values in this run
   int value; // the value itself
@@ -21,6 +23,9 @@ typedef struct {
 
   size_t len; // number of run tuples in the array
   size_t cap; // available slots for run tuples in the array
+
+  Arena* arena; // where `data` lives while the array is being built
+                // (NULL if it's on the heap, see `seal_rle_array`)
 } RLEArray;
 
 void init_rle_array(RLEArray* arr);
@@ -38,6 +43,12 @@ void push_rle_array(RLEArray* arr, int val);
  */
 int get_nth_rle_array(RLEArray* arr, size_t n);
 
+/** Remove the last `n` elements from a RLE array. */
+void truncate_rle_array(RLEArray* arr, size_t n);
+
+/** Move the runs out of the array's arena, onto the heap (at exact size). */
+void seal_rle_array(RLEArray* arr);
+
 void free_rle_array(RLEArray* arr);
 
 #endif // __CLOX_RLE_ARRAY_H__
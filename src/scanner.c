@@ -40,6 +40,7 @@ static void init_keywords() {
   init_trie(&keywords);
   trie_push(&keywords, "and", TOKEN_AND);
   trie_push(&keywords, "class", TOKEN_CLASS);
+  trie_push(&keywords, "const", TOKEN_CONST);
   trie_push(&keywords, "else", TOKEN_ELSE);
   trie_push(&keywords, "false", TOKEN_FALSE);
   trie_push(&keywords, "for", TOKEN_FOR);
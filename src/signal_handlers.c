@@ -2,6 +2,7 @@
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include "heap_snapshot.h"
 #include "signal_handlers.h"
 
 #define EX_SEGFAULT 139
@@ -25,8 +26,14 @@ static void segv_handler(int signal) {
   exit(EX_SEGFAULT);
 }
 
+// kill -USR1 <pid> writes a heap snapshot (at the next safepoint)
+static void usr1_handler(int signal) {
+  request_heap_snapshot();
+}
+
 void install_signal_handlers() {
   signal(SIGSEGV, segv_handler);
+  signal(SIGUSR1, usr1_handler);
 }
 
 // ---
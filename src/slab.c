@@ -0,0 +1,267 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "slab.h"
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#ifdef __SANITIZE_ADDRESS__
+#include <sanitizer/asan_interface.h>
+#else
+#define ASAN_POISON_MEMORY_REGION(addr, size)   ((void) (addr), (void) (size))
+#define ASAN_UNPOISON_MEMORY_REGION(addr, size) ((void) (addr), (void) (size))
+#endif
+
+// each slab is carved up into blocks of a single size class
+#define SLAB_SIZE (64 * 1024)
+
+/**
+ * Small allocations (strings' characters, upvalue arrays, and most
+ * objects) come and go constantly, so rather than passing each one to
+ * `malloc`, they're rounded up to a size class, and served from slabs
+ * of same-sized blocks. Freed blocks are pushed onto their class's
+ * free list, and reused before the current slab is carved any further.
+ *
+ *     slab:  [header][blk][blk][blk][blk][ - - - - - - ]
+ *                      |          ^      ^
+ *     free list:       '----------'     top
+ *
+ * Since every block in a class is the same size, there's no per-block
+ * header, and no splitting or coalescing. Slabs are aligned to their
+ * size, so a block's slab can be found from its address. Slabs are only
+ * returned to the system once they're empty, after their blocks have
+ * been moved elsewhere (see `slab_begin_evacuation`), or when the VM is
+ * freed.
+ */
+typedef struct Slab {
+  struct Slab* next;
+  uint32_t     live;       // blocks currently allocated from this slab
+  uint8_t      class;
+  bool         evacuating; // (see `slab_begin_evacuation`)
+} Slab;
+
+#define SLAB_OF(ptr) ((Slab*) ((uintptr_t) (ptr) & ~((uintptr_t) SLAB_SIZE - 1)))
+
+typedef struct Block {
+  struct Block* next; // (only while it's on a free list)
+} Block;
+
+typedef struct {
+  Block*   free;
+  uint8_t* top; // next unused byte of the current slab
+  uint8_t* end;
+} SizeClass;
+
+#define SLAB_HEADER_SIZE 16
+
+_Static_assert(sizeof(Slab) <= SLAB_HEADER_SIZE, "slab header is too big");
+
+static struct {
+  SizeClass classes[SLAB_CLASS_COUNT];
+  Slab*     slabs;
+  Slab*     current[SLAB_CLASS_COUNT]; // the slab each class is carving up
+  Block*    evacuated[SLAB_CLASS_COUNT]; // (while evacuating) free blocks
+                                         // in slabs that are being emptied
+
+  size_t slab_count;
+  size_t block_bytes;     // in blocks that are currently allocated
+  size_t requested_bytes; // (the same, before rounding up)
+} heap;
+
+static void new_slab(SizeClass* class) {
+  Slab* slab = (Slab*) aligned_alloc(SLAB_SIZE, SLAB_SIZE);
+  if (slab == NULL) exit(1);
+
+  slab->next = heap.slabs;
+  slab->live = 0;
+  slab->class = (uint8_t) (class - heap.classes);
+  slab->evacuating = false;
+  heap.slabs = slab;
+  heap.current[slab->class] = slab;
+  heap.slab_count++;
+
+  class->top = (uint8_t*) slab + SLAB_HEADER_SIZE;
+  class->end = (uint8_t*) slab + SLAB_SIZE;
+
+  // the unused part of the slab is off limits until it's handed out
+  ASAN_POISON_MEMORY_REGION(class->top, class->end - class->top);
+}
+
+void* slab_allocate(size_t size) {
+  int idx = SLAB_CLASS(size);
+  size_t block_size = (idx + 1) * SLAB_GRANULE;
+  SizeClass* class = &heap.classes[idx];
+
+  heap.block_bytes += block_size;
+  heap.requested_bytes += size;
+
+  Block* block = class->free;
+  if (block != NULL) {
+    ASAN_UNPOISON_MEMORY_REGION(block, block_size);
+    class->free = block->next;
+  } else {
+    if ((size_t) (class->end - class->top) < block_size) new_slab(class);
+
+    block = (Block*) class->top;
+    class->top += block_size;
+    ASAN_UNPOISON_MEMORY_REGION(block, block_size);
+  }
+
+  SLAB_OF(block)->live++;
+  return block;
+}
+
+void slab_free(void* ptr, size_t size) {
+  int idx = SLAB_CLASS(size);
+  size_t block_size = (idx + 1) * SLAB_GRANULE;
+  SizeClass* class = &heap.classes[idx];
+
+  heap.block_bytes -= block_size;
+  heap.requested_bytes -= size;
+
+  Block* block = (Block*) ptr;
+  Slab* slab = SLAB_OF(block);
+  slab->live--;
+
+  // blocks in a slab that's being emptied aren't reused (for now)
+  Block** list = slab->evacuating ? &heap.evacuated[idx] : &class->free;
+  block->next = *list;
+  *list = block;
+  ASAN_POISON_MEMORY_REGION(block, block_size);
+}
+
+// how full a slab is, as a fraction of the blocks it could hold
+static double occupancy(Slab* slab) {
+  size_t block_size = (slab->class + 1) * SLAB_GRANULE;
+  size_t blocks = (SLAB_SIZE - SLAB_HEADER_SIZE) / block_size;
+  return (double) slab->live / blocks;
+}
+
+size_t slab_begin_evacuation(double max_occupancy) {
+  size_t count = 0;
+
+  for (Slab* slab = heap.slabs; slab != NULL; slab = slab->next) {
+    // (the current slab is still being carved up, so leave it be)
+    slab->evacuating = slab != heap.current[slab->class] && occupancy(slab) < max_occupancy;
+    if (slab->evacuating) count++;
+  }
+
+  if (count == 0) return 0;
+
+  // set aside the free blocks in slabs that are being evacuated, so
+  // that nothing's moved into them
+  for (int i = 0; i < SLAB_CLASS_COUNT; i++) {
+    Block* block = heap.classes[i].free;
+    heap.classes[i].free = NULL;
+
+    while (block != NULL) {
+      ASAN_UNPOISON_MEMORY_REGION(block, sizeof(Block));
+      Block* next = block->next;
+
+      Block** list = SLAB_OF(block)->evacuating ? &heap.evacuated[i] : &heap.classes[i].free;
+      block->next = *list;
+      *list = block;
+
+      ASAN_POISON_MEMORY_REGION(block, sizeof(Block));
+      block = next;
+    }
+  }
+
+  return count;
+}
+
+bool slab_is_evacuating(void* ptr) {
+  return SLAB_OF(ptr)->evacuating;
+}
+
+size_t slab_end_evacuation() {
+  // slabs that still have blocks in use (that weren't moved) are kept,
+  // and their free blocks go back on the free lists
+  for (int i = 0; i < SLAB_CLASS_COUNT; i++) {
+    Block* block = heap.evacuated[i];
+    while (block != NULL) {
+      ASAN_UNPOISON_MEMORY_REGION(block, sizeof(Block));
+      Block* next = block->next;
+
+      if (SLAB_OF(block)->live > 0) {
+        block->next = heap.classes[i].free;
+        heap.classes[i].free = block;
+      }
+
+      ASAN_POISON_MEMORY_REGION(block, sizeof(Block));
+      block = next;
+    }
+
+    heap.evacuated[i] = NULL;
+  }
+
+  // ...and the rest are released
+  size_t released = 0;
+  Slab** link = &heap.slabs;
+  while (*link != NULL) {
+    Slab* slab = *link;
+
+    if (slab->evacuating && slab->live == 0) {
+      *link = slab->next;
+      heap.slab_count--;
+      released += SLAB_SIZE;
+
+      ASAN_UNPOISON_MEMORY_REGION(slab, SLAB_SIZE);
+      free(slab);
+      continue;
+    }
+
+    slab->evacuating = false;
+    link = &slab->next;
+  }
+
+#ifdef __GLIBC__
+  // (freed slabs are too small to have been mmap'd on their own, so
+  // ask for the pages they leave free to be handed back to the system)
+  if (released > 0) malloc_trim(0);
+#endif
+
+  return released;
+}
+
+double slab_fragmentation() {
+  size_t reserved = heap.slab_count * SLAB_SIZE;
+  if (reserved == 0) return 0;
+  return (double) (reserved - heap.block_bytes) / reserved;
+}
+
+size_t slab_reserved_bytes() {
+  return heap.slab_count * SLAB_SIZE;
+}
+
+void free_slabs() {
+  Slab* slab = heap.slabs;
+  while (slab != NULL) {
+    Slab* next = slab->next;
+    ASAN_UNPOISON_MEMORY_REGION(slab, SLAB_SIZE);
+    free(slab);
+    slab = next;
+  }
+
+  memset(&heap, 0, sizeof(heap));
+}
+
+void print_slab_stats() {
+  size_t reserved = heap.slab_count * SLAB_SIZE;
+  if (reserved == 0) return;
+
+  // memory that's been carved off a slab but isn't in use (freed
+  // blocks, and the unused ends of slabs) is fragmentation
+  fprintf(stderr, "slabs: %zu (%zu KB), %zu KB in blocks (%zu KB requested), %.1f%% unused\n",
+          heap.slab_count, reserved / 1024,
+          heap.block_bytes / 1024, heap.requested_bytes / 1024,
+          100.0 * (reserved - heap.block_bytes) / reserved);
+}
+
+// ---
+
+#undef SLAB_SIZE
+#undef SLAB_HEADER_SIZE
+#undef SLAB_OF
@@ -0,0 +1,63 @@
+#ifndef __CLOX_SLAB_H__
+#define __CLOX_SLAB_H__
+
+#include "common.h"
+
+// allocations up to this size are served from slabs (anything
+// bigger goes straight to the system allocator)
+#define SLAB_MAX_SIZE 256
+
+// slab size classes are this many bytes apart (objects are mostly made
+// of pointers and values, so finer classes would only waste space on
+// alignment, and coarser ones on rounding up)
+#define SLAB_GRANULE 8
+
+#define SLAB_CLASS_COUNT (SLAB_MAX_SIZE / SLAB_GRANULE)
+#define SLAB_CLASS(size) (((size) - 1) / SLAB_GRANULE)
+
+#define IS_SLAB_SIZE(size) ((size) > 0 && (size) <= SLAB_MAX_SIZE)
+
+/**
+ * Allocate a small block (`size` must be in 1..SLAB_MAX_SIZE). It's
+ * rounded up to its size class, and taken from that class's free list,
+ * or else carved off the class's current slab.
+ */
+void* slab_allocate(size_t size);
+
+/** Return a block to its size class's free list (`size` as allocated). */
+void slab_free(void* ptr, size_t size);
+
+/**
+ * Start emptying out the slabs that are less than `max_occupancy` full
+ * (0 to 1), so that they can be given back to the system: until
+ * `slab_end_evacuation`, their free blocks aren't handed out, so any
+ * blocks that are allocated (to move things out of them) come from
+ * other slabs.
+ *
+ * @return how many slabs are being evacuated
+ */
+size_t slab_begin_evacuation(double max_occupancy);
+
+/** Whether a block is in a slab that's being evacuated. */
+bool slab_is_evacuating(void* ptr);
+
+/**
+ * Release the evacuated slabs that are now empty (any that aren't go
+ * back to normal).
+ *
+ * @return how many bytes were released
+ */
+size_t slab_end_evacuation();
+
+/** The fraction of slab memory that isn't in use (0 to 1). */
+double slab_fragmentation();
+
+size_t slab_reserved_bytes();
+
+/** Release every slab back to the system (invalidating all blocks). */
+void free_slabs();
+
+/** Print how much memory the slabs hold, and how much of it is in use. */
+void print_slab_stats();
+
+#endif // __CLOX_SLAB_H__
@@ -1,179 +1,666 @@
+#include <math.h>
 #include <stdio.h>
 #include <string.h>
+#include "gc.h"
 #include "memory.h"
 #include "object.h"
 #include "table.h"
+#include "vm.h"
 
-// load factor
-#define TABLE_LOAD_MAX 0.75
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
-#define TOMBSTONE() (BOOL_VAL(true))
-#define TABLE_IS_EMPTY(tab) (tab->len == 0)
+// load factor (probing stays cheap even when the table is quite full,
+// since most of it only touches control bytes)
+#define TABLE_LOAD_MAX 0.875
+
+// tables shrink when deletes leave them emptier than this
+#define TABLE_LOAD_MIN 0.125
+
+// tables are rebuilt without their tombstones once they take up this
+// much of it (since, unlike empty buckets, they don't end a lookup)
+#define TOMBSTONE_MAX 0.25
+
+// control bytes are compared this many at a time (and tables are never
+// smaller than a group)
+#define GROUP_WIDTH 16
+
+// control bytes of empty and deleted buckets have their high bit set,
+// and full ones hold their key's tag (the top 7 bits of its hash)
+#define CTRL_EMPTY   ((uint8_t) 0x80)
+#define CTRL_DELETED ((uint8_t) 0xFE)
+#define IS_FULL(ctrl) (((ctrl) & 0x80) == 0)
+
+#define HASH_TAG(hash) ((uint8_t) ((hash) >> 25))
+
+#define TABLE_BYTES(cap) ((cap) * sizeof(Entry) + (cap) + GROUP_WIDTH)
+#define TABLE_IS_EMPTY(tab) ((tab)->len == 0 && (tab)->old_len == 0)
+#define TABLE_LIVE(tab) ((tab)->len - (tab)->tombstones + (tab)->old_len)
+
+// -- groups
+//
+// A bitmask of the control bytes in a group that match, where bit `i`
+// stands for the `i`th bucket of the group.
+
+typedef uint32_t GroupMask;
+
+#ifdef __SSE2__
+
+static inline GroupMask match_byte(const uint8_t* group, uint8_t byte) {
+  __m128i ctrl = _mm_loadu_si128((const __m128i*) group);
+  return (GroupMask) _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char) byte)));
+}
+
+// (empty and deleted buckets are the ones with their high bit set)
+static inline GroupMask match_empty_or_deleted(const uint8_t* group) {
+  return (GroupMask) _mm_movemask_epi8(_mm_loadu_si128((const __m128i*) group));
+}
+
+#else
+
+static inline GroupMask match_byte(const uint8_t* group, uint8_t byte) {
+  GroupMask mask = 0;
+  for (int i = 0; i < GROUP_WIDTH; i++) {
+    if (group[i] == byte) mask |= 1u << i;
+  }
+  return mask;
+}
+
+static inline GroupMask match_empty_or_deleted(const uint8_t* group) {
+  GroupMask mask = 0;
+  for (int i = 0; i < GROUP_WIDTH; i++) {
+    if (!IS_FULL(group[i])) mask |= 1u << i;
+  }
+  return mask;
+}
+
+#endif
+
+// (the position of the lowest bit set, then clear it)
+#define NEXT_MATCH(mask) (__builtin_ctz(mask))
+#define DROP_MATCH(mask) ((mask) &= (mask) - 1)
+
+// Groups are probed at triangular offsets from the key's home bucket:
+// home, home + 16, home + 48, home + 96, ... which (since the capacity
+// is a power of two) eventually covers every bucket.
+typedef struct {
+  size_t pos;
+  size_t step;
+  size_t mask;
+} Probe;
+
+static inline Probe probe_start(uint32_t hash, size_t cap) {
+  return (Probe) { .pos = hash & (cap - 1), .step = 0, .mask = cap - 1 };
+}
+
+static inline void probe_next(Probe* probe) {
+  probe->step += GROUP_WIDTH;
+  probe->pos = (probe->pos + probe->step) & probe->mask;
+}
+
+// (the buckets of a table, or the ones it's moving out of while it's
+// being rehashed)
+typedef struct {
+  Entry*   entries;
+  uint8_t* control;
+  size_t   cap;
+} Buckets;
+
+#define BUCKETS(tab)     ((Buckets) { (tab)->entries, (tab)->control, (tab)->cap })
+#define OLD_BUCKETS(tab) ((Buckets) { (tab)->old_entries, (tab)->old_control, (tab)->old_cap })
+#define IS_REHASHING(tab) ((tab)->old_entries != NULL)
+
+static inline void set_control(Buckets b, size_t idx, uint8_t ctrl) {
+  b.control[idx] = ctrl;
+
+  // (keep the copy of the first group in sync)
+  if (idx < GROUP_WIDTH) b.control[b.cap + idx] = ctrl;
+}
+
+// -- keys
+
+// (a 64-bit finalizer, from MurmurHash3, so that every bit of the input
+// affects both the low bits that pick the home bucket and the top ones
+// that make up the tag)
+static inline uint32_t mix_bits(uint64_t bits) {
+  bits ^= bits >> 33;
+  bits *= 0xff51afd7ed558ccdull;
+  bits ^= bits >> 33;
+  bits *= 0xc4ceb9fe1a85ec53ull;
+  bits ^= bits >> 33;
+  return (uint32_t) bits;
+}
+
+static inline uint32_t hash_value(Value key) {
+  if (IS_OBJ(key)) {
+    Obj* obj = AS_OBJ(key);
+    if (obj_type(obj) == OBJ_STRING) return ((ObjString*) obj)->hash;
+    return mix_bits((uintptr_t) obj); // (see `table_move_key`)
+  }
+
+  if (IS_NUMBER(key)) {
+    // (equal numbers must hash the same, and 0 == -0, while every NaN
+    // is the same key, see `keys_equal`)
+    double num = AS_NUMBER(key);
+    if (num == 0)   num = 0;
+    if (isnan(num)) num = NAN;
+
+    uint64_t bits;
+    memcpy(&bits, &num, sizeof(bits));
+    return mix_bits(bits);
+  }
+
+  if (IS_BOOL(key)) return mix_bits(AS_BOOL(key) ? 2 : 1);
+  return mix_bits(0); // nil
+}
+
+static inline bool keys_equal(Value a, Value b) {
+  if (a.type != b.type) return false;
+  if (IS_OBJ(a)) return AS_OBJ(a) == AS_OBJ(b);
+
+  if (IS_NUMBER(a)) {
+    return AS_NUMBER(a) == AS_NUMBER(b) || (isnan(AS_NUMBER(a)) && isnan(AS_NUMBER(b)));
+  }
+
+  if (IS_BOOL(a)) return AS_BOOL(a) == AS_BOOL(b);
+  return true; // nil
+}
+
+uint32_t table_hash_key(Value key) {
+  return hash_value(key);
+}
+
+// -- lookup
 
 void init_table(Table* tab) {
   tab->entries = NULL;
+  tab->control = NULL;
   tab->len = 0;
   tab->cap = 0;
+  tab->tombstones = 0;
+
+  tab->old_entries = NULL;
+  tab->old_control = NULL;
+  tab->old_cap = 0;
+  tab->old_len = 0;
+  tab->rehash_pos = 0;
+}
+
+static void free_buckets(Buckets b) {
+  if (b.cap > 0) reallocate(b.entries, TABLE_BYTES(b.cap), 0);
 }
 
 void free_table(Table* tab) {
-  FREE_ARRAY(Entry, tab->entries, tab->cap);
+  forget_entries(tab); // (so the remembered set can't point at it)
+  free_buckets(BUCKETS(tab));
+  free_buckets(OLD_BUCKETS(tab));
   init_table(tab);
 }
 
-// Walk the array of entries starting from the key's hash, noting the
-// first tombstone encountered. If an entry with a matching key
-// is found, return that. If not, continue traversing until an
-// empty bucket is encountered. If any tombstones were encountered,
-// return the first. If not, return the empty bucket.
-//
-// For example, when finding entry `x` in the following
-//
-//      0  1  2  3
-//     [x][ ][T][ ]  #=> 0 (found matching entry)
+size_t table_bytes(Table* tab) {
+  size_t bytes = tab->cap == 0 ? 0 : TABLE_BYTES(tab->cap);
+  if (IS_REHASHING(tab)) bytes += TABLE_BYTES(tab->old_cap);
+  return bytes;
+}
+
+// @return the bucket holding `key` (whose hash is `hash`), or -1 if it
+//         isn't in `b`
+static inline ssize_t find_bucket(Buckets b, Value key, uint32_t hash) {
+  uint8_t tag = HASH_TAG(hash);
+
+  // in a big table, the control bytes and the entries are both likely
+  // to miss the cache, so start fetching the home entry in the meantime
+  __builtin_prefetch(&b.entries[hash & (b.cap - 1)]);
+
+  for (Probe probe = probe_start(hash, b.cap);; probe_next(&probe)) {
+    const uint8_t* group = &b.control[probe.pos];
+
+    for (GroupMask match = match_byte(group, tag); match != 0; DROP_MATCH(match)) {
+      size_t idx = (probe.pos + NEXT_MATCH(match)) & probe.mask;
+      if (keys_equal(b.entries[idx].key, key)) return (ssize_t) idx;
+    }
+
+    // a key is always inserted into the first free bucket along its
+    // probe sequence, so if there's an empty one here, it isn't further on
+    if (match_byte(group, CTRL_EMPTY) != 0) return -1;
+  }
+}
+
+// @return the first bucket along the hash's probe sequence that doesn't
+//         hold a key (empty or deleted)
+static size_t find_free_bucket(Buckets b, uint32_t hash) {
+  for (Probe probe = probe_start(hash, b.cap);; probe_next(&probe)) {
+    GroupMask free = match_empty_or_deleted(&b.control[probe.pos]);
+    if (free != 0) return (probe.pos + NEXT_MATCH(free)) & probe.mask;
+  }
+}
+
+// (the key mustn't already be in the table)
+static void insert_entry(Table* tab, Value key, Value val) {
+  Buckets b = BUCKETS(tab);
+  uint32_t hash = hash_value(key);
+  size_t idx = find_free_bucket(b, hash);
+
+  // only increment length if we _aren't_ replacing a tombstone
+  if (b.control[idx] == CTRL_EMPTY) tab->len++;
+  else                              tab->tombstones--;
+
+  set_control(b, idx, HASH_TAG(hash));
+  b.entries[idx].key = key;
+  b.entries[idx].value = val;
+}
+
+// A deleted bucket only needs a tombstone if some lookup might have
+// probed past it, which can only happen if a group it's part of was ever
+// completely full. If every group it's part of (the ones starting up to
+// GROUP_WIDTH - 1 buckets before it) still has an empty bucket in it,
+// then no key was ever put further along some probe sequence because of
+// it, and it can simply be emptied.
 //
-//     [ ][ ][T][ ]  #=> 0 (first empty bucket)
+// @return true if a tombstone was left behind
+static bool delete_bucket(Buckets b, size_t idx) {
+  GroupMask empty_after = match_byte(&b.control[idx], CTRL_EMPTY);
+  GroupMask empty_before = match_byte(&b.control[(idx - GROUP_WIDTH) & (b.cap - 1)], CTRL_EMPTY);
+
+  // (the number of full or deleted buckets in a row around this one)
+  bool was_never_full = empty_after != 0 && empty_before != 0 &&
+    (size_t) (NEXT_MATCH(empty_after) + __builtin_clz(empty_before << 16)) < GROUP_WIDTH;
+
+  set_control(b, idx, was_never_full ? CTRL_EMPTY : CTRL_DELETED);
+  return !was_never_full;
+}
+
+// (see `delete_bucket`)
+static void delete_entry(Table* tab, size_t idx) {
+  if (delete_bucket(BUCKETS(tab), idx)) tab->tombstones++;
+  else                                  tab->len--;
+}
+
+// (only the control bytes are initialized: an entry is never read
+// unless its bucket is full, so for a big table, the rest of the pages
+// aren't touched until they're first inserted into)
+static Buckets allocate_buckets(size_t cap) {
+  Entry* entries = (Entry*) reallocate(NULL, 0, TABLE_BYTES(cap));
+  uint8_t* control = (uint8_t*) (entries + cap);
+
+  memset(control, CTRL_EMPTY, cap + GROUP_WIDTH);
+
+  return (Buckets) { entries, control, cap };
+}
+
+// -- rehashing
 //
-//     [-][ ][T][ ]  #=> 1 (first empty bucket)
+// Big tables are resized incrementally. Rather than moving every entry
+// into the new buckets at once (a long stall, for a table with millions
+// of keys, in the middle of whichever insert happened to fill it up),
+// the old buckets are kept around, and each operation on the table
+// moves the next REHASH_STEP of them over. Until they've all been moved,
+// lookups check the old buckets first, then the new ones.
 //
-//     [-][-][T][ ]  #=> 2 (first tombstone)
+//     old:  [-][-][-][-][a][ ][b][c]      new:  [ ][ ][ ][ ][ ][ ][ ][ ]
+//                        ^ rehash_pos           [ ][d][ ][ ][ ][ ][ ][ ]
 //
-static Entry* find_entry(Entry* entries, size_t cap, ObjString* key) {
-  Entry* tombstone = NULL;
-  uint32_t bucket_idx = key->hash % cap;
-
-  for (;;) {
-    Entry* entry = &entries[bucket_idx];
-
-    if (entry->key == NULL) {
-      if (IS_NIL(entry->value)) {    // empty entry
-        return tombstone != NULL ? tombstone : entry;
-      } else {                       // tombstone
-        if (tombstone == NULL) tombstone = entry;
-      }
-    } else if (entry->key == key) {
-      return entry;                  // found it!
-    }
+// New keys always go into the new buckets. Since the new buckets have
+// twice the room, and at least REHASH_STEP old buckets are moved with
+// every insert, the old ones are long gone before the new ones fill up.
+
+// tables with at least this many buckets are resized incrementally
+#define REHASH_MIN_CAP 1024
+
+// how many old buckets to move with each operation, while rehashing
+#define REHASH_STEP 8
 
-    bucket_idx = (bucket_idx + 1) % cap; // wrap around if we hit
-                                         // the last bucket
+static void rehash_some(Table* tab, size_t count) {
+  Buckets old = OLD_BUCKETS(tab);
+  size_t end = old.cap - tab->rehash_pos < count ? old.cap : tab->rehash_pos + count;
+
+  for (size_t i = tab->rehash_pos; i < end; i++) {
+    if (!IS_FULL(old.control[i])) continue;
+
+    insert_entry(tab, old.entries[i].key, old.entries[i].value);
+    delete_bucket(old, i); // (so it can't be found there again)
+    tab->old_len--;
   }
+
+  tab->rehash_pos = end;
+  if (end < old.cap) return;
+
+  free_buckets(old);
+  tab->old_entries = NULL;
+  tab->old_control = NULL;
+  tab->old_cap = 0;
+  tab->old_len = 0;
+  tab->rehash_pos = 0;
+}
+
+static void finish_rehash(Table* tab) {
+  if (IS_REHASHING(tab)) rehash_some(tab, SIZE_MAX);
 }
 
+// move the table's entries into `cap` new buckets (leaving any
+// tombstones behind), all at once
 static void adjust_capacity(Table* tab, size_t cap) {
-  Entry* entries = ALLOCATE(Entry, cap);
+  finish_rehash(tab);
+
+  Buckets b = allocate_buckets(cap);
+  Buckets old = BUCKETS(tab);
+
+  tab->entries = b.entries;
+  tab->control = b.control;
+  tab->cap = b.cap;
+  tab->len = 0;
+  tab->tombstones = 0;
 
-  // initialize new bucket storage
-  for (size_t i = 0; i < cap; i++) {
-    entries[i].key = NULL;
-    entries[i].value = NIL_VAL;
+  for (size_t i = 0; i < old.cap; i++) {
+    if (IS_FULL(old.control[i])) insert_entry(tab, old.entries[i].key, old.entries[i].value);
   }
 
-  // copy over existing bucket entries
-  tab->len = 0; // reset to zero...
-  for (size_t i = 0; i < tab->cap; i++) {
-    Entry* entry = &tab->entries[i];
-    if (entry->key == NULL) continue; // skip empty buckets
+  free_buckets(old);
+}
+
+// start moving the table's entries into `cap` new buckets, a few at a time
+static void begin_rehash(Table* tab, size_t cap) {
+  finish_rehash(tab);
+
+  Buckets b = allocate_buckets(cap);
+
+  tab->old_entries = tab->entries;
+  tab->old_control = tab->control;
+  tab->old_cap = tab->cap;
+  tab->rehash_pos = 0;
 
-    Entry* dest = find_entry(entries, cap, entry->key);
-    dest->key = entry->key;
-    dest->value = entry->value;
-    tab->len++; // ...then increment for non-tombstone entries
+  // (only the full buckets are still to be moved)
+  tab->old_len = 0;
+  for (size_t i = 0; i < tab->cap; i++) {
+    if (IS_FULL(tab->control[i])) tab->old_len++;
   }
 
-  // free previous storage
-  FREE_ARRAY(Entry, tab->entries, tab->cap);
+  tab->entries = b.entries;
+  tab->control = b.control;
+  tab->cap = b.cap;
+  tab->len = 0;
+  tab->tombstones = 0;
+}
+
+static size_t grow_capacity(size_t cap) {
+  return cap < GROUP_WIDTH ? GROUP_WIDTH : cap * 2;
+}
 
-  // update table to point at new storage
-  tab->entries = entries;
-  tab->cap = cap;
+// @return the capacity to rebuild a table with `live` entries at, leaving
+//         it half full (so it has room to grow, or shrink, before it has
+//         to be rebuilt again)
+static size_t capacity_for(size_t live) {
+  size_t cap = grow_capacity(0);
+  while (live > cap * TABLE_LOAD_MAX / 2) cap = grow_capacity(cap);
+  return cap;
 }
 
-bool table_set(Table* tab, ObjString* key, Value val) {
-  if (tab->len + 1 > tab->cap * TABLE_LOAD_MAX) {
-    size_t cap = GROW_CAPACITY(tab->cap);
-    adjust_capacity(tab, cap);
-  }
+// rebuild the table with `cap` buckets (incrementally, if it's big)
+static void resize(Table* tab, size_t cap) {
+  if (tab->cap >= REHASH_MIN_CAP) begin_rehash(tab, cap);
+  else                            adjust_capacity(tab, cap);
+}
 
-  Entry* entry = find_entry(tab->entries, tab->cap, key);
-  bool is_new_key = entry->key == NULL;
+static bool is_sparse(Table* tab) {
+  return tab->cap > GROUP_WIDTH && TABLE_LIVE(tab) < tab->cap * TABLE_LOAD_MIN;
+}
 
-  // only increment length if we _aren't_ replacing a tombstone
-  if (is_new_key && /* isn't tombstone */ IS_NIL(entry->value)) {
-    tab->len++;
+// (while rehashing)
+static void rehash_step(Table* tab) {
+  rehash_some(tab, REHASH_STEP);
+
+  // deletes don't shrink the table while it's being rehashed, so if it's
+  // emptied out in the meantime, carry on shrinking it
+  if (!IS_REHASHING(tab) && is_sparse(tab)) resize(tab, capacity_for(TABLE_LIVE(tab)));
+}
+
+// @return the key's entry (wherever it is), or NULL
+static Entry* find_entry(Table* tab, Value key) {
+  if (TABLE_IS_EMPTY(tab)) return NULL;
+
+  uint32_t hash = hash_value(key);
+
+  if (IS_REHASHING(tab)) {
+    rehash_step(tab);
+
+    if (IS_REHASHING(tab)) {
+      ssize_t idx = find_bucket(OLD_BUCKETS(tab), key, hash);
+      if (idx >= 0) return &tab->old_entries[idx];
+    }
   }
 
-  entry->key = key;
-  entry->value = val;
-  return is_new_key;
+  ssize_t idx = find_bucket(BUCKETS(tab), key, hash);
+  return idx < 0 ? NULL : &tab->entries[idx];
 }
 
-bool table_get(Table* tab, ObjString* key, Value* out) {
-  if (TABLE_IS_EMPTY(tab)) return false; // empty tables don't contain anything
+bool table_set(Table* tab, Value key, Value val) {
+  Entry* entry = find_entry(tab, key);
+
+  if (entry != NULL) {
+    entry->value = val;
+    remember_entry(tab, key, val);
+    return false;
+  }
+
+  // (entries that are still in the old buckets will end up in these ones,
+  // and if it's mostly tombstones that are filling it up, it's rebuilt
+  // without them at the same size (or smaller), rather than doubled)
+  if (tab->len + tab->old_len + 1 > tab->cap * TABLE_LOAD_MAX) {
+    resize(tab, capacity_for(TABLE_LIVE(tab)));
+  }
+
+  insert_entry(tab, key, val);
+
+  remember_entry(tab, key, val);
+  return true;
+}
 
-  Entry* entry = find_entry(tab->entries, tab->cap, key);
-  if (entry->key == NULL) return false; // key isn't contained in table
+bool table_get(Table* tab, Value key, Value* out) {
+  Entry* entry = find_entry(tab, key);
+  if (entry == NULL) return false; // key isn't contained in table
 
   *out = entry->value; // found key, write value to out pointer
   return true;
 }
 
-bool table_delete(Table* tab, ObjString* key) {
+bool table_delete(Table* tab, Value key) {
   if (TABLE_IS_EMPTY(tab)) return false;
 
-  Entry* entry = find_entry(tab->entries, tab->cap, key);
-  if (entry->key == NULL) return false;
+  uint32_t hash = hash_value(key);
+
+  if (IS_REHASHING(tab)) {
+    rehash_step(tab);
+
+    if (IS_REHASHING(tab)) {
+      ssize_t idx = find_bucket(OLD_BUCKETS(tab), key, hash);
+      if (idx >= 0) {
+        delete_bucket(OLD_BUCKETS(tab), (size_t) idx);
+        tab->old_len--;
+        return true;
+      }
+    }
+  }
+
+  ssize_t idx = find_bucket(BUCKETS(tab), key, hash);
+  if (idx < 0) return false;
+
+  delete_entry(tab, (size_t) idx);
+
+  // shrink the table once it's mostly empty, or rebuild it if it's
+  // filling up with tombstones (but not in the middle of a rehash, which
+  // will leave the tombstones behind anyway)
+  if (IS_REHASHING(tab)) return true;
+
+  if (is_sparse(tab) || tab->tombstones > tab->cap * TOMBSTONE_MAX) {
+    size_t cap = capacity_for(TABLE_LIVE(tab));
+    resize(tab, cap < tab->cap ? cap : tab->cap);
+  }
 
-  entry->key = NULL;
-  entry->value = TOMBSTONE();
   return true;
 }
 
-// similar to table_find_key, but searches with a raw C string
+Entry* table_find_entry(Table* tab, Value key) {
+  return find_entry(tab, key);
+}
+
+void table_move_key(Table* tab, Value from, Value to) {
+  Entry* entry = find_entry(tab, from);
+  if (entry == NULL) return;
+
+  // (strings keep their hash wherever they are)
+  if (hash_value(from) == hash_value(to)) {
+    entry->key = to;
+    return;
+  }
+
+  Value val = entry->value;
+  table_delete(tab, from);
+  table_set(tab, to, val);
+}
+
+void table_rehash(Table* tab) {
+  finish_rehash(tab);
+  if (tab->cap > 0) adjust_capacity(tab, tab->cap);
+}
+
+static ObjString* find_string(Buckets b, const char* chars, size_t len, uint32_t hash) {
+  uint8_t tag = HASH_TAG(hash);
+  __builtin_prefetch(&b.entries[hash & (b.cap - 1)]); // (see `find_bucket`)
+
+  for (Probe probe = probe_start(hash, b.cap);; probe_next(&probe)) {
+    const uint8_t* group = &b.control[probe.pos];
+
+    for (GroupMask match = match_byte(group, tag); match != 0; DROP_MATCH(match)) {
+      Value key = b.entries[(probe.pos + NEXT_MATCH(match)) & probe.mask].key;
+      if (!IS_STRING(key)) continue;
+
+      // key with same length and chars must be a match
+      ObjString* str = AS_STRING(key);
+      if (str->hash == hash && str->len == len && memcmp(str->chars, chars, len) == 0) {
+        return str;
+      }
+    }
+
+    // empty (non-tombstone) bucket, string must not be here
+    if (match_byte(group, CTRL_EMPTY) != 0) return NULL;
+  }
+}
+
+// similar to table_find_entry, but searches with a raw C string
 ObjString* table_find_string(Table* tab, const char* chars, size_t len, uint32_t hash) {
   if (TABLE_IS_EMPTY(tab)) return NULL;
 
-  uint32_t bucket_idx = hash % tab->cap;
-  for (;;) {
-    Entry* entry = &tab->entries[bucket_idx];
+  if (IS_REHASHING(tab)) {
+    rehash_step(tab);
 
-    if (entry->key == NULL) {
-      // empty (non-tombstone) bucket, string must not be here
-      if (IS_NIL(entry->value)) return NULL;
-    } else if (entry->key->len == len &&
-               memcmp(entry->key->chars, chars, len) == 0) {
-      // key with same length and chars must be a match
-      return entry->key;
+    if (IS_REHASHING(tab)) {
+      ObjString* key = find_string(OLD_BUCKETS(tab), chars, len, hash);
+      if (key != NULL) return key;
     }
+  }
+
+  return find_string(BUCKETS(tab), chars, len, hash);
+}
+
+Entry* table_next(Table* tab, size_t* cursor) {
+  // (the old buckets, if it's being rehashed, then the new ones)
+  while (*cursor < tab->old_cap + tab->cap) {
+    size_t i = (*cursor)++;
+    Buckets b = i < tab->old_cap ? OLD_BUCKETS(tab) : BUCKETS(tab);
+    if (i >= tab->old_cap) i -= tab->old_cap;
 
-    bucket_idx = (bucket_idx + 1) % tab->cap;
+    if (IS_FULL(b.control[i])) return &b.entries[i];
   }
+
+  return NULL;
 }
 
-void table_merge(Table* src, Table* dest) {
-  for (size_t i = 0; i < src->cap; i++) {
-    Entry* entry = &src->entries[i];
-    if (entry->key != NULL) {
-      table_set(dest, entry->key, entry->value);
+void table_remove_unmarked(Table* tab) {
+  // (this visits every bucket anyway, so it might as well finish moving them)
+  finish_rehash(tab);
+
+  size_t live = 0;
+  size_t removed = 0;
+
+  for (size_t i = 0; i < tab->cap; i++) {
+    if (!IS_FULL(tab->control[i])) continue;
+    Entry* entry = &tab->entries[i];
+
+    // (young keys are never marked, and are dealt with by minor collections,
+    // while keys that aren't objects can't be collected at all)
+    Obj* key = IS_OBJ(entry->key) ? AS_OBJ(entry->key) : NULL;
+    if (key == NULL || IS_YOUNG(key) || is_marked(key)) {
+      live++;
+      continue;
     }
+
+    delete_entry(tab, i);
+    removed++;
+  }
+
+  if (removed == 0) return;
+
+  // rebuild without the tombstones, leaving room to grow before the next
+  // collection
+  size_t cap = capacity_for(live);
+  if (cap > tab->cap) cap = tab->cap;
+
+  adjust_capacity(tab, cap);
+}
+
+void table_compact(Table* tab) {
+  finish_rehash(tab);
+  if (tab->cap == 0) return;
+
+  size_t live = TABLE_LIVE(tab);
+  if (live == 0) {
+    free_table(tab);
+    return;
   }
+
+  size_t cap = capacity_for(live);
+  if (cap > tab->cap) cap = tab->cap;
+
+  if (cap < tab->cap || tab->tombstones > 0) adjust_capacity(tab, cap);
 }
 
-static void dump_bucket(Entry* bucket, size_t cap, size_t bucket_idx) {
+void table_reserve(Table* tab, size_t count) {
+  finish_rehash(tab);
+
+  size_t cap = tab->cap;
+  while (count > cap * TABLE_LOAD_MAX) cap = grow_capacity(cap);
+
+  if (cap != tab->cap) adjust_capacity(tab, cap);
+}
+
+void table_merge(Table* src, Table* dest) {
+  size_t cursor = 0;
+  for (Entry* entry; (entry = table_next(src, &cursor)) != NULL;) {
+    table_set(dest, entry->key, entry->value);
+  }
+}
+
+static void dump_bucket(Table* tab, size_t bucket_idx) {
+  Entry* bucket = &tab->entries[bucket_idx];
+
   if (bucket_idx > 0) printf(" | ");
-  if (bucket->key != NULL) {
-    printf("<bucket_%zu> \\\"%s\\\"\\nhash: %zu", bucket_idx,
-                                                  bucket->key->chars,
-                                                  bucket->key->hash % cap);
-  } else if (IS_NIL(bucket->value)) {
+  if (IS_FULL(tab->control[bucket_idx])) {
+    printf("<bucket_%zu> ", bucket_idx);
+    if (IS_STRING(bucket->key)) printf("\\\"%s\\\"", AS_STRING(bucket->key)->chars);
+    else                        print_value(bucket->key);
+    printf("\\nhash: %u", hash_value(bucket->key) & (uint32_t) (tab->cap - 1));
+  } else if (tab->control[bucket_idx] == CTRL_EMPTY) {
     printf("<bucket_%zu>", bucket_idx); // empty bucket
   } else {
     printf("<bucket_%zu> [T]", bucket_idx);
   }
 }
 
-static void dump_bucket_value(Entry* bucket, size_t bucket_idx) {
-  if (bucket->key == NULL) return; // skip empty buckets and tombstones
+static void dump_bucket_value(Table* tab, size_t bucket_idx) {
+  if (!IS_FULL(tab->control[bucket_idx])) return; // skip empty buckets and tombstones
+
+  Entry* bucket = &tab->entries[bucket_idx];
 
   printf("  value_%zu [label=\"", bucket_idx);
   print_value(bucket->value);
@@ -193,6 +680,8 @@ static void dump_bucket_value(Entry* bucket, size_t bucket_idx) {
  *
  */
 void dump_table(Table* tab) {
+  finish_rehash(tab);
+
   if (TABLE_IS_EMPTY(tab)) {
     printf("graph { empty [shape=box] }");
     return;
@@ -202,16 +691,32 @@ void dump_table(Table* tab) {
   printf("  node [shape=record]\n");
   printf("  table [label=\"");
   for (size_t i = 0; i < tab->cap; i++) {
-    dump_bucket(&tab->entries[i], tab->cap, i); // heh, don't spill it
+    dump_bucket(tab, i); // heh, don't spill it
   }
   printf("\"]\n");
   for (size_t i = 0; i < tab->cap; i++) {
-    dump_bucket_value(&tab->entries[i], i);
+    dump_bucket_value(tab, i);
   }
   printf("}");
 }
 
 // ---
 
-#undef TOMBSTONE
+#undef TABLE_LOAD_MAX
+#undef TABLE_LOAD_MIN
+#undef TOMBSTONE_MAX
+#undef GROUP_WIDTH
+#undef CTRL_EMPTY
+#undef CTRL_DELETED
+#undef IS_FULL
+#undef HASH_TAG
+#undef TABLE_BYTES
 #undef TABLE_IS_EMPTY
+#undef TABLE_LIVE
+#undef NEXT_MATCH
+#undef DROP_MATCH
+#undef BUCKETS
+#undef OLD_BUCKETS
+#undef IS_REHASHING
+#undef REHASH_MIN_CAP
+#undef REHASH_STEP
@@ -4,51 +4,67 @@
 #include "common.h"
 #include "value.h"
 
-// TODO: support numeric keys
+// Keys can be any value. Numbers, booleans, and nil are compared by
+// value (all NaNs are the same key, as are 0 and -0), strings by their
+// precomputed hash and identity (since they're interned), and any other
+// object by identity. Slices aren't interned, so intern them (see
+// `copy_string`) before using them as keys.
 typedef struct {
-  ObjString* key;
+  Value key;
   Value value;
 } Entry;
 
 /**
- * Basic implementation of a hash table (hashmap) using
- * open addressing. So-called "buckets" are allocated
- * and begin empty, then are filled with a single key-value
- * pair when storing a new value. A hash function is
- * used to determine the bucket offset to store a value
- * in, and if that bucket is already filled (if there is
- * a hash collision), the subsequent buckets will be
- * traversed until an empty one is found, looping back around
- * to the start of the table if no empty buckets are found.
+ * A hash table using open addressing, laid out like a "Swiss table":
+ * alongside the array of entries is an array of control bytes, one per
+ * entry, which says whether the entry is empty, deleted (a tombstone),
+ * or full, and if it's full, holds 7 bits of its key's hash (its tag).
  *
- * Key deletion is done using tombstones, marking previously-
- * filled buckets so they don't offset the open addressing
- * scheme. Tombstones will remain until they're overwritten
- * by a new value. They may also be removed by copying the
- * buckets over to a new table, since they'll be excluded
- * and won't be present in the new table.
+ *     control: [E][a][E][D][E][b][c][E] ... [a][E][D] ...
+ *     entries: [ ]["foo"][ ][ ][ ][12.5][true][ ]
+ *                                              |-- copy of the first
+ *                                                  GROUP_WIDTH bytes
  *
- *     [ ][a][ ][T][ ][b][c][ ]  8 buckets
- *         |     |     |  |
- *         |     |     |  |- "baz"
- *         |     |     |
- *         |     |     |- "bar"
- *         |     |
- *         |     |- tombstone
- *         |
- *         |- "foo"
+ * Lookups start at the bucket given by the low bits of the hash, and
+ * compare a whole group of 16 control bytes against the tag at once
+ * (with a single SSE2 comparison, where available). Only entries whose
+ * tag matches are actually looked at, so a lookup usually touches one
+ * entry, and probing through collisions (and tombstones) is cheap. A
+ * group with an empty control byte in it ends the search. Groups are
+ * probed at triangular offsets from the starting bucket, which visits
+ * every one of them, since the capacity is a power of two.
  *
- *     a: "foo", hash = 1
- *     b: "bar", hash = 13 % 8 = 5
- *     c: "baz", hash = 5 (shifted over to next empty bucket)
+ * Key deletion is done using tombstones, so that deleting a key can't
+ * cut short the search for another one that collided with it (unless
+ * no search could have gone past it, in which case the bucket is simply
+ * emptied). They remain until they're overwritten by a new key, or the
+ * table is rebuilt (which leaves them behind), which happens once they
+ * take up a quarter of it. Tables also shrink once deletes leave them
+ * less than an eighth full.
  *
+ * Big tables grow incrementally: the old buckets are kept until every
+ * entry has been moved out of them, a few at a time with each operation
+ * on the table, so that no single insert has to rehash the whole thing.
+ * While that's happening, entries may be in either set of buckets, so
+ * use `table_next` to iterate over them.
  */
-typedef struct {
-  // dynamic array of hash buckets
-  Entry* entries;
+typedef struct Table {
+  Entry*   entries;
+  uint8_t* control; // `cap` control bytes, then a copy of the first group's
+                    // (so a group can be loaded from any bucket without
+                    // wrapping around); in the same block as `entries`
+
+  size_t len;        // number of filled buckets + tombstones
+  size_t cap;        // available slots (a power of two, or 0)
+  size_t tombstones; // (out of `len`)
 
-  size_t len; // number of filled buckets + tombstones
-  size_t cap; // available slots (including empty buckets)
+  // (while it's being resized incrementally) the buckets that entries
+  // are being moved out of, see `table_set`
+  Entry*   old_entries;
+  uint8_t* old_control;
+  size_t   old_cap;
+  size_t   old_len;    // entries that haven't been moved yet
+  size_t   rehash_pos; // the next old bucket to move
 } Table;
 
 void init_table(Table* tab);
@@ -56,18 +72,72 @@ void init_table(Table* tab);
 void free_table(Table* tab);
 
 /** @return true if a new key was added, false if an existing entry was overwritten */
-bool table_set(Table* tab, ObjString* key, Value val);
+bool table_set(Table* tab, Value key, Value val);
 
 /** @return true if the key was contained in the table */
-bool table_get(Table* tab, ObjString* key, Value* out);
+bool table_get(Table* tab, Value key, Value* out);
 
 /** @return true if the key was contained in the table */
-bool table_delete(Table* tab, ObjString* key);
+bool table_delete(Table* tab, Value key);
+
+/** @return the key's entry, or NULL if it isn't contained in the table */
+Entry* table_find_entry(Table* tab, Value key);
+
+/**
+ * Objects other than strings are hashed by their address, so when the
+ * GC moves one that's used as a key, its entry has to be moved too.
+ * Replace the key `from` (the object's old address) with `to`.
+ */
+void table_move_key(Table* tab, Value from, Value to);
 
+/**
+ * Like `table_move_key`, but for when the keys have already been
+ * updated in place (e.g. while forwarding every reference to the objects
+ * that were moved by compaction): put every entry back where its key's
+ * hash says it should be.
+ */
+void table_rehash(Table* tab);
+
+/**
+ * Step through the table's entries, in no particular order:
+ *
+ *     size_t cursor = 0;
+ *     for (Entry* entry; (entry = table_next(tab, &cursor)) != NULL;) ...
+ *
+ * The table mustn't be changed along the way (apart from the entries'
+ * values, and replacing keys with equal ones).
+ */
+Entry* table_next(Table* tab, size_t* cursor);
+
+/** @return the hash a key is stored under */
+uint32_t table_hash_key(Value key);
+
+/** @return the string key with the given characters, or NULL */
 ObjString* table_find_string(Table* tab, const char* chars, size_t len, uint32_t hash);
 
 void table_merge(Table* src, Table* dest);
 
+/**
+ * Delete every entry whose key is an old object that wasn't marked by the
+ * last collection (making the table weak), then shrink the table to fit.
+ */
+void table_remove_unmarked(Table* tab);
+
+/**
+ * Rebuild the table without its tombstones, and as small as it can be
+ * while leaving room to grow (freeing its buckets entirely if it's
+ * empty). Deletes only shrink a table once it's an eighth full, so this
+ * is for when memory's tight, e.g. after a collection that was forced
+ * by the heap limit.
+ */
+void table_compact(Table* tab);
+
+/** Grow the table (if needed) so it can hold `count` entries without resizing. */
+void table_reserve(Table* tab, size_t count);
+
+/** @return how many bytes the table's buckets take up */
+size_t table_bytes(Table* tab);
+
 void dump_table(Table* tab);
 
 #endif // __CLOX_TABLE_H__
@@ -5,6 +5,7 @@
 #define IS_EMPTY(trie) (trie->data == NULL)
 #define CHAR_TO_INDEX(c) ((int) c - (int) 'a')
 #define INDEX_TO_CHAR(i) ((char) ((int) 'a' + i))
+#define IS_LOWER_ALPHA(c) (c >= 'a' && c <= 'z')
 
 void init_trie(Trie* trie) {
   trie->data = NULL;
@@ -13,34 +14,35 @@ void init_trie(Trie* trie) {
 }
 
 void free_trie(Trie* trie) {
-  FREE_ARRAY(TrieLeaf*, trie->data, trie->cap);
+  FREE_ARRAY(TrieLeaf, trie->data, trie->cap);
   init_trie(trie);
 }
 
 static void init_leaf(TrieLeaf* leaf) {
-  memset(leaf->links, 0, ALPHABET_SIZE * sizeof(TrieLeaf*));
+  memset(leaf->links, TRIE_NO_LINK, ALPHABET_SIZE * sizeof(uint16_t));
   leaf->terminal = TOKEN__NULL__;
 }
 
-static TrieLeaf* create_leaf(Trie* trie) {
+// note that this may reallocate the trie's storage, invalidating
+// any existing pointers to its leaves
+static uint16_t create_leaf(Trie* trie) {
   if (trie->len == trie->cap) {
     size_t old_cap = trie->cap;
     trie->cap = GROW_CAPACITY(old_cap);
     trie->data = GROW_ARRAY(TrieLeaf, trie->data, old_cap, trie->cap);
   }
 
-  TrieLeaf* leaf = &trie->data[trie->len++];
-  init_leaf(leaf);
-  return leaf;
+  init_leaf(&trie->data[trie->len]);
+  return (uint16_t) trie->len++;
 }
 
-static TrieLeaf* get_leaf(Trie* trie, TrieLeaf* curr, char c) {
-  TrieLeaf* link = curr->links[CHAR_TO_INDEX(c)];
-  if (link) return link;
+static uint16_t get_leaf(Trie* trie, uint16_t curr, char c) {
+  uint16_t link = trie->data[curr].links[CHAR_TO_INDEX(c)];
+  if (link != TRIE_NO_LINK) return link;
 
   // if the leaf doesn't already exist, create it
   link = create_leaf(trie);
-  curr->links[CHAR_TO_INDEX(c)] = link;
+  trie->data[curr].links[CHAR_TO_INDEX(c)] = link;
   return link;
 }
 
@@ -48,13 +50,13 @@ void trie_push(Trie* trie, const char* element, TokenType type) {
   // if this is the first time we've pushed, initialize the root leaf
   if (IS_EMPTY(trie)) create_leaf(trie);
 
-  TrieLeaf* curr = trie->data;
+  uint16_t curr = 0;
 
   for (char c = *element; c != '\0'; c = *++element) {
     curr = get_leaf(trie, curr, c);
   }
 
-  curr->terminal = type;
+  trie->data[curr].terminal = type;
 }
 
 TokenType trie_has(Trie* trie, const char* element, size_t len) {
@@ -65,9 +67,12 @@ TokenType trie_has(Trie* trie, const char* element, size_t len) {
 
   for (size_t i = 0; i < len; i++) {
     c = element[i];
-    curr = curr->links[CHAR_TO_INDEX(c)];
+    if (!IS_LOWER_ALPHA(c)) return TOKEN__NULL__; // (e.g. identifiers w/ uppercase)
+
+    uint16_t link = curr->links[CHAR_TO_INDEX(c)];
+    if (link == TRIE_NO_LINK) return TOKEN__NULL__;
 
-    if (curr == NULL) return TOKEN__NULL__;
+    curr = &trie->data[link];
   }
 
   return curr->terminal;
@@ -84,9 +89,9 @@ static void dump_leaf(Trie* trie, TrieLeaf* leaf, TrieLeaf* parent, char c) {
   }
 
   for (size_t i = 0; i < ALPHABET_SIZE; i++) {
-    if (leaf->links[i] == NULL) continue;
+    if (leaf->links[i] == TRIE_NO_LINK) continue;
 
-    dump_leaf(trie, leaf->links[i], leaf, INDEX_TO_CHAR(i));
+    dump_leaf(trie, &trie->data[leaf->links[i]], leaf, INDEX_TO_CHAR(i));
   }
 
 #undef LEAF_ID
@@ -110,3 +115,4 @@ void dump_trie(Trie* trie) {
 #undef IS_EMPTY
 #undef CHAR_TO_INDEX
 #undef INDEX_TO_CHAR
+#undef IS_LOWER_ALPHA
@@ -8,10 +8,15 @@
 // we only care about lowercase ASCII characters
 #define ALPHABET_SIZE 26
 
+// leaves are stored in a growable array, so they link to each other
+// by index (pointers would dangle whenever the array is reallocated);
+// the root is always at index 0, so 0 doubles as "no link"
+#define TRIE_NO_LINK 0
+
 typedef struct TrieLeaf {
-  struct TrieLeaf* links[ALPHABET_SIZE]; // fixed-size array of links to other leaf nodes;
-                                         // if a character isn't valid to follow, its link
-                                         // will be NULL
+  uint16_t links[ALPHABET_SIZE]; // fixed-size array of links to other leaf nodes;
+                                 // if a character isn't valid to follow, its link
+                                 // will be TRIE_NO_LINK
 
   TokenType terminal; // the contained value, if the leaf terminates a contained value
 } TrieLeaf;
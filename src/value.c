@@ -1,7 +1,9 @@
 #include <stdio.h>
 #include <string.h>
+#include "arena.h"
 #include "logger.h"
 #include "memory.h"
+#include "number.h"
 #include "object.h"
 #include "value.h"
 
@@ -9,10 +11,11 @@ void init_value_array(ValueArray* arr) {
   arr->values = NULL;
   arr->cap = 0;
   arr->len = 0;
+  arr->arena = NULL;
 }
 
 void free_value_array(ValueArray* arr) {
-  FREE_ARRAY(Value, arr->values, arr->cap);
+  if (arr->arena == NULL) FREE_ARRAY(Value, arr->values, arr->cap);
   init_value_array(arr);
 }
 
@@ -20,13 +23,26 @@ void value_array_push(ValueArray* arr, Value val) {
   if (arr->len == arr->cap) {
     size_t old_cap = arr->cap;
     arr->cap = GROW_CAPACITY(old_cap);
-    arr->values = GROW_ARRAY(Value, arr->values, old_cap, arr->cap);
+    arr->values = GROW_ARRAY_IN(arr->arena, Value, arr->values, old_cap, arr->cap);
   }
 
   arr->values[arr->len] = val;
   arr->len++;
 }
 
+void seal_value_array(ValueArray* arr) {
+  if (arr->arena == NULL) return;
+
+  // (allocating may collect garbage, but the values are still
+  // reachable through the arena's copy until they're swapped)
+  Value* values = ALLOCATE(Value, arr->len);
+  if (arr->len > 0) memcpy(values, arr->values, sizeof(Value) * arr->len);
+
+  arr->values = values;
+  arr->cap = arr->len;
+  arr->arena = NULL;
+}
+
 /** @return true if the value was contained in the array */
 bool value_array_find_index(ValueArray* arr, Value val, uint16_t* out) {
   for (size_t i = 0; i < arr->len; i++) {
@@ -39,9 +55,22 @@ bool value_array_find_index(ValueArray* arr, Value val, uint16_t* out) {
   return false;
 }
 
+// slices aren't interned, so they're compared by content (against
+// either another slice or a string) instead of by identity
+static bool string_like_equal(Value a, Value b) {
+  size_t a_len, b_len;
+  const char* a_chars = string_like_chars(a, &a_len);
+  const char* b_chars = string_like_chars(b, &b_len);
+  return a_len == b_len && memcmp(a_chars, b_chars, a_len) == 0;
+}
+
 bool values_equal(Value a, Value b) {
   if (a.type != b.type) return false; // equality will always be false across types
 
+  if (IS_SLICE(a) || IS_SLICE(b)) {
+    return is_string_like(a) && is_string_like(b) && string_like_equal(a, b);
+  }
+
   switch (a.type) {
     case VAL_BOOL:   return AS_BOOL(a) == AS_BOOL(b);
     case VAL_NIL:    return true;
@@ -54,6 +83,11 @@ bool values_equal(Value a, Value b) {
   }
 }
 
+static void print_number(double num) {
+  char buf[NUMBER_BUF_MAX];
+  out_write(buf, format_number(num, buf));
+}
+
 void print_value(Value val) {
   switch (val.type) {
     case VAL_BOOL:
@@ -62,7 +96,7 @@ void print_value(Value val) {
                            ANSI_Reset);
       break;
     case VAL_NIL:    out_printf(ANSI_Dim "nil" ANSI_Reset); break;
-    case VAL_NUMBER: out_printf("%g", AS_NUMBER(val)); break;
+    case VAL_NUMBER: print_number(AS_NUMBER(val)); break;
     case VAL_OBJ:    print_object(val); break;
   }
 }
@@ -5,6 +5,7 @@
 
 typedef struct Obj Obj;
 typedef struct ObjString ObjString;
+typedef struct Arena Arena;
 
 typedef enum {
   VAL_BOOL,
@@ -53,6 +54,9 @@ typedef struct {
 
   size_t len; // number of values in array
   size_t cap; // available spaces for values in array
+
+  Arena* arena; // where `values` lives while the array is being built
+                // (NULL if it's on the heap, see `seal_value_array`)
 } ValueArray;
 
 void init_value_array(ValueArray* arr);
@@ -61,6 +65,9 @@ void free_value_array(ValueArray* arr);
 
 void value_array_push(ValueArray* arr, Value val);
 
+/** Move the values out of the array's arena, onto the heap (at exact size). */
+void seal_value_array(ValueArray* arr);
+
 bool value_array_find_index(ValueArray* arr, Value val, uint16_t* out);
 
 bool values_equal(Value a, Value b);
@@ -1,3 +1,4 @@
+#include <math.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
@@ -5,28 +6,16 @@
 #include "common.h"
 #include "compiler.h"
 #include "debug.h"
+#include "gc.h"
+#include "heap_profile.h"
+#include "logger.h"
 #include "memory.h"
+#include "natives.h"
 #include "object.h"
 #include "vm.h"
 
 VM vm; // global singleton, since we don't support parallel VMs
 
-// -- native functions
-
-static Value clock_native(uint8_t argc, Value* argv) {
-  return NUMBER_VAL((double) clock() / CLOCKS_PER_SEC);
-}
-
-static void define_native(const char* name, NativeFn func) {
-  push(OBJ_VAL((Obj*) copy_string(name, (size_t) strlen(name))));
-  push(OBJ_VAL((Obj*) new_native(func)));
-  table_set(&vm.globals, AS_STRING(vm.stack[0]), vm.stack[1]);
-  pop(); // push then pop the values onto the stack to include
-  pop(); // them in garbage collection
-}
-
-// --
-
 static void reset_stack() {
   vm.stack_top = vm.stack;
   vm.frame_count = 0;
@@ -35,18 +24,54 @@ static void reset_stack() {
 
 void init_vm() {           // initialize the VM:
   reset_stack();           // 1. reset the stack
-  vm.objects = NULL;       // 2. initialize object storage (for GC)
+                           // 2. initialize object storage (for GC)
+  for (int i = 0; i < SIZE_CLASS_COUNT; i++) {
+    vm.objects[i] = NULL;
+    vm.unswept[i] = NULL;
+  }
+  vm.sweep_class = 0;
+  vm.gc_state = GC_IDLE;
+  vm.safepoint_requested = false;
+  vm.minor_gc_pending = false;
+  vm.major_gc_pending = false;
+  vm.in_gc = false;
+  vm.bytes_allocated = 0;
+  vm.bytes_peak = 0;
+  vm.next_gc = GC_HEAP_MIN;
+  vm.next_gc_slice = 0;
+  vm.gc_slice_start = 0;
+  vm.gc_max_pause = 0;
+  vm.gc_grow_factor = GC_HEAP_GROW_FACTOR;
+  vm.gc_heap_min = GC_HEAP_MIN;
+  vm.max_heap = 0;
+  vm.gc_compact = -1;
+  vm.compact_pending = false;
+  vm.out_of_memory = NULL;
+  vm.gc_threads = 1;
+  vm.heap_sample = 0;
+  vm.gray = (ObjStack) {0};
+  vm.promoted = (ObjStack) {0};
+  vm.remembered = (ObjStack) {0};
+  vm.remembered_entries = (TableRefStack) {0};
+  init_heap();
   init_table(&vm.globals); // 3. initialize global variable storage
   init_table(&vm.strings); // 4. initialize interned string storage
+  init_table(&vm.consts);  // 5. initialize compile-time constant storage
+  init_table(&vm.declared);
+  vm.natives_inlined = 0;
+  vm.natives_shadowed = 0;
 
-  // 5. define native functions
-  define_native("clock", clock_native);
+  // 6. define native functions
+  define_natives();
 }
 
 void free_vm() {
   free_table(&vm.globals);
   free_table(&vm.strings);
-  free_objects();
+  free_table(&vm.consts);
+  free_table(&vm.declared);
+  free_heap();
+  free_heap_profile();
 }
 
 void push(Value val) {
@@ -87,6 +112,21 @@ static void runtime_error(const char* format, ...) {
   reset_stack();
 }
 
+// An intrinsic op stands in for a direct call to a native, so when its
+// operands are the wrong type, report the same error the call would have
+// (by making it, which only happens on this slow path).
+static void intrinsic_error(OpCode op, uint8_t argc) {
+  for (size_t i = 0; i < natives_count; i++) {
+    const NativeDef* def = &natives[i];
+    if (!(def->flags & NATIVE_INTRINSIC) || def->intrinsic != op) continue;
+
+    Value message;
+    def->function(argc, vm.stack_top - argc, &message);
+    runtime_error("%s", AS_CSTRING(message));
+    return;
+  }
+}
+
 // When executing a function call, the function itself will be pushed
 // onto the stack, followed by the arguments to the call. Then, a new
 // stack frame rooted at the function object will be created, and the
@@ -125,10 +165,20 @@ static bool call_value(Value callee, uint8_t argc) {
     switch (OBJ_TYPE(callee)) {
       case OBJ_CLOSURE:
         return call(AS_CLOSURE(callee), argc);
-      case OBJ_NATIVE: {                                  // to call a native function, invoke
-        NativeFn native = AS_NATIVE(callee);              // the C function pointer, store its
-        Value result = native(argc, vm.stack_top - argc); // return value, then push it on the
-        vm.stack_top -= argc + 1;                         // stack and resume execution
+      case OBJ_NATIVE: {
+        ObjNative* native = AS_NATIVE(callee);
+        if (native->arity != NATIVE_VARIADIC && argc != native->arity) {
+          runtime_error("Expected %d arguments but got %d.", native->arity, argc);
+          return false;
+        }
+
+        Value result;                                                  // to call a native function,
+        if (!native->function(argc, vm.stack_top - argc, &result)) {   // invoke the C function pointer,
+          runtime_error("%s", AS_CSTRING(result));                     // store its return value, then
+          return false;                                                // push it on the stack and
+        }                                                              // resume execution
+
+        vm.stack_top -= argc + 1;
         push(result);
         return true;
       }
@@ -170,6 +220,7 @@ static void close_upvalues(Value* last) {
     ObjUpvalue* uv = vm.open_upvalues;
     uv->closed = *uv->location;
     uv->location = &uv->closed;
+    WRITE_BARRIER(uv, uv->closed);
     vm.open_upvalues = uv->next;
   }
 }
@@ -178,24 +229,29 @@ static inline bool is_falsey(Value val) {
   return IS_NIL(val) || (IS_BOOL(val) && !AS_BOOL(val));
 }
 
+// either operand may be a slice, in which case its characters are
+// copied straight out of the parent string
 static void concatenate_strings() {
-  ObjString* b = AS_STRING(pop());
-  ObjString* a = AS_STRING(pop());
+  Value b = peek(0); // leave the operands on the stack until the result
+  Value a = peek(1); // is allocated, so they aren't garbage collected
 
-  size_t len = a->len + b->len;
+  size_t a_len, b_len;
+  const char* a_chars = string_like_chars(a, &a_len);
+  const char* b_chars = string_like_chars(b, &b_len);
+
+  size_t len = a_len + b_len;
   char* chars = ALLOCATE(char, len + 1);
-  memcpy(chars,          a->chars, a->len);
-  memcpy(chars + a->len, b->chars, b->len);
+  memcpy(chars,         a_chars, a_len);
+  memcpy(chars + a_len, b_chars, b_len);
   chars[len] = '\0';
 
   ObjString* res = take_string(chars, len);
+  pop();
+  pop();
   push(OBJ_VAL((Obj*) res));
 }
 
 // TODO: Store the instruction pointer in a register and benchmark.
-// TODO: Add arity checking for native functions.
-// TODO: Allow native functions to signal runtime errors.
-// TODO: Implement additional native functions.
 // (see https://craftinginterpreters.com/calls-and-functions.html#challenges)
 
 static InterpretResult run() {
@@ -219,7 +275,31 @@ static InterpretResult run() {
     push(value_type(a op b)); \
   } while (0)
 
+// intrinsics operate on the top of the stack in-place
+#define UNARY_MATH_OP(fn, op) \
+  do { \
+    if (!IS_NUMBER(peek(0))) { \
+      intrinsic_error(op, 1); \
+      return INTERPRET_RUNTIME_ERR; \
+    } \
+    (vm.stack_top - 1)->as.number = fn((vm.stack_top - 1)->as.number); \
+  } while (0)
+
+#define BINARY_MATH_OP(fn, op) \
+  do { \
+    if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) { \
+      intrinsic_error(op, 2); \
+      return INTERPRET_RUNTIME_ERR; \
+    } \
+    double b = AS_NUMBER(pop()); \
+    (vm.stack_top - 1)->as.number = fn((vm.stack_top - 1)->as.number, b); \
+  } while (0)
+
   for (;;) {
+    // the top of the dispatch loop is a safepoint, where the nursery
+    // can be collected (and objects moved) safely
+    if (vm.safepoint_requested) gc_safepoint();
+
 #ifdef DEBUG_TRACE_EXEC
     // display current stack
     printf("          ");
@@ -278,19 +358,21 @@ static InterpretResult run() {
 
       case OP_SET_UPVALUE: {
         uint8_t slot = READ_BYTE();
-        *frame->closure->upvalues[slot]->location = peek(0);
+        ObjUpvalue* uv = frame->closure->upvalues[slot];
+        *uv->location = peek(0);
+        WRITE_BARRIER(uv, peek(0)); // (only matters once it's closed)
         break;
       }
 
       case OP_DEF_GLOBAL: {
         ObjString* name = READ_STRING();
-        table_set(&vm.globals, name, peek(0));
+        table_set(&vm.globals, OBJ_VAL((Obj*) name), peek(0));
         pop();
         break;
       }
       case OP_DEF_GLOBAL_LONG: {
         ObjString* name = READ_STRING_LONG();
-        table_set(&vm.globals, name, peek(0));
+        table_set(&vm.globals, OBJ_VAL((Obj*) name), peek(0));
         pop();
         break;
       }
@@ -299,7 +381,7 @@ static InterpretResult run() {
         ObjString* name = READ_STRING();
         Value val;
 
-        if (!table_get(&vm.globals, name, &val)) {
+        if (!table_get(&vm.globals, OBJ_VAL((Obj*) name), &val)) {
           runtime_error("Undefined variable '%s'.", name->chars);
           return INTERPRET_RUNTIME_ERR;
         }
@@ -311,7 +393,7 @@ static InterpretResult run() {
         ObjString* name = READ_STRING_LONG();
         Value val;
 
-        if (!table_get(&vm.globals, name, &val)) {
+        if (!table_get(&vm.globals, OBJ_VAL((Obj*) name), &val)) {
           runtime_error("Undefined variable '%s'.", name->chars);
           return INTERPRET_RUNTIME_ERR;
         }
@@ -323,8 +405,8 @@ static InterpretResult run() {
       case OP_SET_GLOBAL: {
         ObjString* name = READ_STRING();
 
-        if (table_set(&vm.globals, name, peek(0))) {              // if this was the first time we've
-          table_delete(&vm.globals, name);                        // seen this variable, it's set-
+        if (table_set(&vm.globals, OBJ_VAL((Obj*) name), peek(0))) {              // if this was the first time we've
+          table_delete(&vm.globals, OBJ_VAL((Obj*) name));                        // seen this variable, it's set-
           runtime_error("Undefined variable '%s'.", name->chars); // before-define, which isn't allowed
           return INTERPRET_RUNTIME_ERR;
         }
@@ -334,8 +416,8 @@ static InterpretResult run() {
       case OP_SET_GLOBAL_LONG: {
         ObjString* name = READ_STRING_LONG();
 
-        if (table_set(&vm.globals, name, peek(0))) {
-          table_delete(&vm.globals, name);
+        if (table_set(&vm.globals, OBJ_VAL((Obj*) name), peek(0))) {
+          table_delete(&vm.globals, OBJ_VAL((Obj*) name));
           runtime_error("Undefined variable '%s'.", name->chars);
           return INTERPRET_RUNTIME_ERR;
         }
@@ -346,7 +428,7 @@ static InterpretResult run() {
       // -- binary ops --
       case OP_ADD: { // the + operator is special because it can
                      // operate on both numbers and strings
-        if (IS_STRING(peek(0)) && IS_STRING(peek(1))) {
+        if (is_string_like(peek(0)) && is_string_like(peek(1))) {
           concatenate_strings();
         } else if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
           double b = AS_NUMBER(pop());
@@ -389,10 +471,18 @@ static InterpretResult run() {
         (vm.stack_top - 1)->as.number *= -1;
         break;
 
+      // -- intrinsics --
+      case OP_SQRT:  UNARY_MATH_OP(sqrt, OP_SQRT); break;
+      case OP_FLOOR: UNARY_MATH_OP(floor, OP_FLOOR); break;
+      case OP_ABS:   UNARY_MATH_OP(fabs, OP_ABS); break;
+      case OP_MIN:   BINARY_MATH_OP(fmin, OP_MIN); break;
+      case OP_MAX:   BINARY_MATH_OP(fmax, OP_MAX); break;
+      case OP_CLOCK: push(NUMBER_VAL((double) clock() / CLOCKS_PER_SEC)); break;
+
       // -- statements --
       case OP_PRINT: {
         print_value(pop());
-        printf("\n");
+        out_printf("\n");
         break;
       }
 
@@ -484,6 +574,8 @@ static InterpretResult run() {
 #undef READ_STRING
 #undef READ_STRING_LONG
 #undef BINARY_OP
+#undef UNARY_MATH_OP
+#undef BINARY_MATH_OP
 }
 
 InterpretResult interpret(const char* source) {
@@ -492,9 +584,29 @@ InterpretResult interpret(const char* source) {
 
   // the first slot in the stack contains the top-level function
   // (which is really just a function with no arguments, right?)
-  ObjClosure* closure = new_closure(func);
+  push(OBJ_VAL((Obj*) func)); // (keep the function reachable while
+  ObjClosure* closure = new_closure(func); // allocating its closure)
+  pop();
   push(OBJ_VAL((Obj*) closure));
   call(closure, 0);
 
-  return run();
+  // if memory runs out, the script is stopped with a runtime error
+  // (unwinding from wherever the allocation was, see `out_of_memory`)
+  jmp_buf out_of_memory;
+  if (setjmp(out_of_memory) != 0) {
+    vm.out_of_memory = NULL;
+
+    if (vm.max_heap > 0) {
+      runtime_error("Out of memory (the heap is limited to %zu bytes).", vm.max_heap);
+    } else {
+      runtime_error("Out of memory.");
+    }
+    return INTERPRET_RUNTIME_ERR;
+  }
+
+  vm.out_of_memory = &out_of_memory;
+  InterpretResult res = run();
+  vm.out_of_memory = NULL;
+
+  return res;
 }
@@ -1,7 +1,9 @@
 #ifndef __CLOX_VM_H__
 #define __CLOX_VM_H__
 
+#include <setjmp.h>
 #include "chunk.h"
+#include "gc.h"
 #include "table.h"
 #include "value.h"
 #include "object.h"
@@ -77,8 +79,57 @@ typedef struct {
   // stored in a dynamically-sized array, keyed by index.
 
   Table    globals; // storage for global variables at runtime
+  Table    consts;  // compile-time constants (inlined at each use site, so
+                    // they never need to be looked up at runtime)
+  Table    declared; // names the compiler has seen declared as globals (so
+                     // a constant can't take over one of them)
+  uint64_t natives_inlined;  // bitsets (indexed by position in `natives`) of
+  uint64_t natives_shadowed; // the natives whose calls have been inlined or
+                             // folded, and those redefined as globals (kept
+                             // for the VM's lifetime, so the REPL sees
+                             // earlier lines)
   Table    strings; // container for interned strings
-  Obj*     objects; // linked-list for naive garbage collection
+  Obj*     objects[SIZE_CLASS_COUNT]; // linked-lists of every old-generation
+                                     // object, by size class
+  Obj*     unswept[SIZE_CLASS_COUNT]; // (while sweeping) objects that haven't
+                                     // been swept yet, by size class
+  int      sweep_class;              // (while sweeping) the next class to sweep
+
+  Nursery nursery;          // young objects (not in `objects`)
+  GCState gc_state;
+  bool safepoint_requested; // there's GC work to do at the next safepoint
+  bool minor_gc_pending;    // the nursery is full
+  bool major_gc_pending;    // time to start an incremental collection
+  bool in_gc;               // don't start a collection during another
+
+  size_t bytes_allocated; // old-generation heap usage (as seen by `reallocate`)
+  size_t bytes_peak;      // high-water mark of `bytes_allocated`
+  size_t next_gc;         // collect garbage once usage crosses this
+  size_t next_gc_slice;   // (while marking) do more marking once usage crosses this
+  size_t gc_slice_start;  // (while marking) usage as of the last slice
+  double gc_max_pause;    // target for incremental pauses, in ms (0 to always
+                          // collect the whole heap at once)
+  double gc_grow_factor;  // how much the heap can grow between collections
+                          // (relative to what survived the last one)
+  size_t gc_heap_min;     // don't collect until the heap is at least this big
+  size_t max_heap;        // hard limit on `bytes_allocated` (0 for none)
+  double gc_compact;      // compact the heap once this percentage of slab
+                          // memory is unused (negative to never compact)
+  bool compact_pending;   // (see `compact_heap`)
+  jmp_buf* out_of_memory; // (while running a script) where to unwind to if
+                          // memory runs out (see `out_of_memory`)
+  int gc_threads;         // threads to mark with (when collecting all at once)
+  size_t heap_sample;     // profile an allocation every this many bytes, on
+                          // average (0 to not profile, see `heap_profile.h`)
+
+  ObjStack gray;       // objects that have been marked, but whose
+                       // references haven't been traced yet
+  ObjStack promoted;   // objects that have been promoted, but whose
+                       // references haven't been updated yet
+  ObjStack remembered; // old objects which may reference young ones
+                       // (the write barrier's remembered set)
+
+  TableRefStack remembered_entries; // likewise, for table entries
 
   ObjUpvalue* open_upvalues; // sorted linked-list (by stack index) tracking
                              // open upvalues (when a new upvalue is captured,
@@ -0,0 +1,68 @@
+#include <math.h>
+#include <stdint.h>
+#include "../src/arena.h"
+#include "../src/chunk.h"
+#include "../src/object.h"
+#include "../src/vm.h"
+#include "common.h"
+#include "chunk.h"
+
+// enough constants for the index to grow a few times
+#define CONST_COUNT 5000
+
+static void test_shared_constants(Chunk* chunk) {
+  Value str = OBJ_VAL((Obj*) copy_string("foo", 3));
+
+  uint16_t zero = add_shared_constant(chunk, NUMBER_VAL(0));
+  uint16_t foo = add_shared_constant(chunk, str);
+  assert(add_shared_constant(chunk, NUMBER_VAL(0)) == zero);
+  assert(add_shared_constant(chunk, OBJ_VAL((Obj*) copy_string("foo", 3))) == foo);
+
+  // -0 and NaN are never shared
+  uint16_t neg_zero = add_shared_constant(chunk, NUMBER_VAL(-0.0));
+  assert(neg_zero != zero);
+  assert(add_shared_constant(chunk, NUMBER_VAL(-0.0)) != neg_zero);
+  assert(add_shared_constant(chunk, NUMBER_VAL(NAN)) != add_shared_constant(chunk, NUMBER_VAL(NAN)));
+
+  // (nor is anything other than a string or a number)
+  Value func = OBJ_VAL((Obj*) new_function());
+  push(func);
+  assert(add_shared_constant(chunk, func) != add_shared_constant(chunk, func));
+  pop();
+
+  size_t len = chunk->constants.len;
+  for (int i = 0; i < CONST_COUNT; i++) add_shared_constant(chunk, NUMBER_VAL(i + 0.5));
+  for (int i = 0; i < CONST_COUNT; i++) {
+    assert(add_shared_constant(chunk, NUMBER_VAL(i + 0.5)) == len + i);
+  }
+  assert(chunk->constants.len == len + CONST_COUNT);
+}
+
+void test_chunk() {
+  init_vm();
+  vm.next_gc = SIZE_MAX; // (the chunks aren't rooted anywhere)
+
+  // (while the chunk's being compiled, the pool is indexed)
+  Arena arena;
+  init_arena(&arena);
+
+  Chunk chunk;
+  init_chunk(&chunk);
+  chunk_use_arena(&chunk, &arena);
+  test_shared_constants(&chunk);
+
+  seal_chunk(&chunk);
+  free_chunk(&chunk);
+  free_arena(&arena);
+
+  // (otherwise, it's scanned)
+  init_chunk(&chunk);
+  test_shared_constants(&chunk);
+  free_chunk(&chunk);
+
+  free_vm();
+}
+
+// ---
+
+#undef CONST_COUNT
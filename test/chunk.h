@@ -0,0 +1,6 @@
+#ifndef __TEST_CHUNK_H__
+#define __TEST_CHUNK_H__
+
+void test_chunk();
+
+#endif // __TEST_CHUNK_H__
@@ -5,12 +5,12 @@
 #include <string.h>
 #include <sysexits.h>
 #include "common.h"
+#include "../src/gc.h"
 #include "../src/logger.h"
+#include "../src/vm.h"
 
-// TODO: Run each script located in /fixtures, and
-//       1. record stdout
-//       2. record stderr
-//       3. record exit code
+// Run each script located in /fixtures, and check that it runs without
+// errors, and that what it prints matches the `.out` file next to it.
 
 #define FIXTURES_DIR     "./test/fixtures/"
 #define FIXTURES_DIR_LEN 16
@@ -34,45 +34,121 @@ static char* fixture_output_path(const char* fixture_path) {
   return output_path;
 }
 
+// @return the file's contents (which the caller must free), or NULL
+static char* read_fixture(const char* path) {
+  FILE* f = fopen(path, "rb");
+  if (f == NULL) return NULL;
+
+  fseek(f, 0L, SEEK_END);
+  size_t size = ftell(f);
+  rewind(f);
+
+  char* buf = (char*) malloc(size + 1);
+  size_t n_read = fread(buf, sizeof(char), size, f);
+  buf[n_read] = '\0';
+
+  fclose(f);
+  return buf;
+}
+
+// Each script is run once with the default settings, then again with
+// each of the collector's other modes (and a small heap, so that even
+// short scripts are collected), so that a broken write barrier or a
+// reference that isn't forwarded changes what the script prints.
+typedef struct {
+  const char* name;
+  size_t heap_min;   // (see the `VM` fields of the same names)
+  double max_pause;
+  int    threads;
+  double compact;
+} GCConfig;
+
+#define SMALL_HEAP (64 * 1024)
+
+static const GCConfig gc_configs[] = {
+  {"default",     GC_HEAP_MIN, 0,    1, -1},
+  {"incremental", SMALL_HEAP,  0.01, 1, -1},
+  {"parallel",    SMALL_HEAP,  0,    4, -1},
+  {"compacting",  SMALL_HEAP,  0,    1,  0},
+};
+
+#define GC_CONFIG_COUNT (sizeof(gc_configs) / sizeof(GCConfig))
+
+static void run_fixture(const char* path, const char* output_path) {
+  char* source = read_fixture(path);
+  char* expected = read_fixture(output_path);
+  assert(source != NULL);
+  if (expected == NULL) fprintf(stderr, "missing %s\n", output_path);
+  assert(expected != NULL);
+
+  for (size_t i = 0; i < GC_CONFIG_COUNT; i++) {
+    const GCConfig* config = &gc_configs[i];
+
+    // (each run gets a fresh VM)
+    rewind(test_stdout);
+    init_vm();
+    vm.gc_heap_min = config->heap_min;
+    vm.gc_max_pause = config->max_pause;
+    vm.gc_threads = config->threads;
+    vm.gc_compact = config->compact;
+    schedule_next_gc();
+
+    InterpretResult res = interpret(source);
+    free_vm();
+
+    fputc('\0', test_stdout);
+    fflush(test_stdout);
+
+    if (res != INTERPRET_OK || strcmp(test_stdout_buf, expected) != 0) {
+      fprintf(stderr, "%s (%s collector) printed:\n%s\nbut expected:\n%s\n",
+              path, config->name, test_stdout_buf, expected);
+    }
+    assert(res == INTERPRET_OK);
+    assert(strcmp(test_stdout_buf, expected) == 0);
+  }
+
+  free(expected);
+  free(source);
+}
+
 static bool has_suffix(struct dirent* f, const char* suffix) {
   char* name = f->d_name;
   size_t name_len = strlen(name);
   return strcmp(&name[name_len - strlen(suffix)], suffix) == 0;
 }
 
+static int is_fixture(const struct dirent* f) {
+  if (f->d_name[0] == '.') return 0; // skip `.` and `..`
+  return has_suffix((struct dirent*) f, ".lox");
+}
+
 void test_fixtures() {
   test_stdout = open_memstream(&test_stdout_buf, &test_stdout_max);
   test_stderr = open_memstream(&test_stderr_buf, &test_stderr_max);
   logger_redirect_out(test_stdout);
   logger_redirect_err(test_stderr);
 
-  DIR* fixtures = opendir(FIXTURES_DIR);
-  if (!fixtures) {
+  // (in order by name, so that any state one VM leaks into the next
+  // shows up the same way every time)
+  struct dirent** fixtures;
+  int count = scandir(FIXTURES_DIR, &fixtures, is_fixture, alphasort);
+  if (count < 0) {
     fprintf(stderr, "unable to open fixtures directory");
     exit(EX_IOERR);
   }
 
-  struct dirent* f;
-  while ((f = readdir(fixtures)) != NULL) {
-    if (f->d_name[0] == '.') continue; // skip `.` and `..`
-    if (!has_suffix(f, ".lox")) continue;
-
-    char* path = fixture_path(f->d_name);
+  for (int i = 0; i < count; i++) {
+    char* path = fixture_path(fixtures[i]->d_name);
     char* output_path = fixture_output_path(path);
 
-    fprintf(stderr, "path: %s\n", path);
-    fprintf(stderr, "output_path: %s\n", output_path);
+    run_fixture(path, output_path);
 
     free(output_path);
     free(path);
+    free(fixtures[i]);
   }
 
-  // yay, redirecting output to a buffer works!
-  out_printf("hello, world!\n");
-  fflush(test_stdout);
-  printf("test_stdout: %s\n", test_stdout_buf);
-
-  closedir(fixtures);
+  free(fixtures);
 
   logger_restore_out();
   logger_restore_err();
@@ -82,5 +158,7 @@ void test_fixtures() {
 
 #undef FIXTURES_DIR
 #undef FIXTURES_DIR_LEN
+#undef SMALL_HEAP
+#undef GC_CONFIG_COUNT
 #undef STDOUT_MAX
 #undef STDERR_MAX
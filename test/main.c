@@ -1,7 +1,13 @@
+#include "chunk.h"
 #include "common.h"
 #include "fixtures.h"
+#include "number.h"
+#include "object.h"
 #include "../src/logger.h"
+#include "rle_array.h"
+#include "table.h"
 #include "trie.h"
+#include "vm.h"
 
 static void __test_success(const char* message) {
   fprintf(stderr, ANSI_BGGreen ANSI_Black "  \u2713  " ANSI_Reset " " \
@@ -17,6 +23,24 @@ int main() {
   test_trie();
   __test_success("test/trie");
 
+  test_number();
+  __test_success("test/number");
+
+  test_rle_array();
+  __test_success("test/rle_array");
+
+  test_object();
+  __test_success("test/object");
+
+  test_chunk();
+  __test_success("test/chunk");
+
+  test_table();
+  __test_success("test/table");
+
+  test_vm();
+  __test_success("test/vm");
+
   __test_success("All tests passed!");
   return 0;
 }
@@ -0,0 +1,70 @@
+#include <string.h>
+#include "../src/number.h"
+#include "common.h"
+#include "number.h"
+
+#define ROUNDTRIP_SAMPLES 100000
+
+static bool formats_as(double num, const char* expected) {
+  char buf[NUMBER_BUF_MAX];
+  size_t len = format_number(num, buf);
+  return len == strlen(expected) && memcmp(buf, expected, len) == 0;
+}
+
+static bool parses_as(const char* literal, double expected) {
+  return parse_number(literal, strlen(literal)) == expected;
+}
+
+// format random bit patterns, then make sure they parse back to
+// exactly the same double
+static bool roundtrips() {
+  uint64_t state = 0x853c49e6748fea9bull;
+
+  for (int i = 0; i < ROUNDTRIP_SAMPLES; i++) {
+    state = state * 6364136223846793005ull + 1442695040888963407ull;
+
+    double num;
+    memcpy(&num, &state, sizeof(num));
+    if (num != num || num - num != 0) continue; // skip nan and inf
+
+    char buf[NUMBER_BUF_MAX + 1];
+    buf[format_number(num, buf)] = '\0';
+
+    double parsed = strtod(buf, NULL);
+    if (memcmp(&parsed, &num, sizeof(num)) != 0) return false;
+  }
+
+  return true;
+}
+
+void test_number() {
+  assert(formats_as(0, "0"));
+  assert(formats_as(-0.0, "-0"));
+  assert(formats_as(42, "42"));
+  assert(formats_as(-7, "-7"));
+  assert(formats_as(0.1, "0.1"));
+  assert(formats_as(0.1 + 0.2, "0.30000000000000004"));
+  assert(formats_as(1.0 / 3, "0.3333333333333333"));
+  assert(formats_as(123.456, "123.456"));
+  assert(formats_as(0.0001, "0.0001"));
+  assert(formats_as(0.00001, "1e-05"));
+  assert(formats_as(1e16, "10000000000000000"));
+  assert(formats_as(1e21, "1e+21"));
+  assert(formats_as(1.7976931348623157e308, "1.7976931348623157e+308"));
+  assert(formats_as(5e-324, "5e-324"));
+  assert(formats_as(1.0 / 0.0, "inf"));
+  assert(formats_as(-1.0 / 0.0, "-inf"));
+  assert(roundtrips());
+
+  assert(parses_as("0", 0));
+  assert(parses_as("12345", 12345));
+  assert(parses_as("3.14159", 3.14159));
+  assert(parses_as("0.1", 0.1));
+  assert(parses_as("9007199254740993", 9007199254740993.0));
+  assert(parses_as("123456789012345678901234567890", 123456789012345678901234567890.0));
+  assert(parses_as("0.30000000000000000000000000001", 0.30000000000000000000000000001));
+}
+
+// ---
+
+#undef ROUNDTRIP_SAMPLES
@@ -0,0 +1,6 @@
+#ifndef __TEST_NUMBER_H__
+#define __TEST_NUMBER_H__
+
+void test_number();
+
+#endif // __TEST_NUMBER_H__
@@ -0,0 +1,32 @@
+#include "../src/object.h"
+#include "common.h"
+#include "object.h"
+
+void test_object() {
+  assert(sizeof(Obj) == 8);
+
+  static ObjString a, b;
+  Obj* obj = (Obj*) &a;
+
+  obj->header = (uint64_t) OBJ_UPVALUE << OBJ_TYPE_SHIFT;
+  assert(obj_type(obj) == OBJ_UPVALUE);
+  assert(obj_next(obj) == NULL);
+  assert(!is_marked(obj));
+  assert(!is_remembered(obj));
+
+  // each field can be set without disturbing the others
+  set_obj_next(obj, (Obj*) &b);
+  set_marked(obj, true);
+  assert(obj_next(obj) == (Obj*) &b);
+  assert(obj_type(obj) == OBJ_UPVALUE);
+  assert(is_marked(obj));
+  assert(!is_remembered(obj));
+
+  set_remembered(obj, true);
+  set_marked(obj, false);
+  set_obj_next(obj, NULL);
+  assert(obj_next(obj) == NULL);
+  assert(obj_type(obj) == OBJ_UPVALUE);
+  assert(!is_marked(obj));
+  assert(is_remembered(obj));
+}
@@ -0,0 +1,6 @@
+#ifndef __TEST_OBJECT_H__
+#define __TEST_OBJECT_H__
+
+void test_object();
+
+#endif // __TEST_OBJECT_H__
@@ -0,0 +1,31 @@
+#include "../src/rle_array.h"
+#include "common.h"
+#include "rle_array.h"
+
+void test_rle_array() {
+  RLEArray arr;
+
+  init_rle_array(&arr);
+
+  // [(2x 1), (3x 2), (1x 3)]
+  push_rle_array(&arr, 1);
+  push_rle_array(&arr, 1);
+  push_rle_array(&arr, 2);
+  push_rle_array(&arr, 2);
+  push_rle_array(&arr, 2);
+  push_rle_array(&arr, 3);
+
+  assert(arr.len == 3);
+
+  assert(get_nth_rle_array(&arr, 0) == 1);
+  assert(get_nth_rle_array(&arr, 1) == 1);
+  assert(get_nth_rle_array(&arr, 2) == 2); // (the first element of a run)
+  assert(get_nth_rle_array(&arr, 4) == 2);
+  assert(get_nth_rle_array(&arr, 5) == 3);
+
+  truncate_rle_array(&arr, 2);
+  assert(arr.len == 2);
+  assert(get_nth_rle_array(&arr, 3) == 2);
+
+  free_rle_array(&arr);
+}
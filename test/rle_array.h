@@ -0,0 +1,6 @@
+#ifndef __TEST_RLE_ARRAY_H__
+#define __TEST_RLE_ARRAY_H__
+
+void test_rle_array();
+
+#endif // __TEST_RLE_ARRAY_H__
@@ -0,0 +1,258 @@
+#include <math.h>
+#include <stdint.h>
+#include "../src/gc.h"
+#include "../src/object.h"
+#include "../src/table.h"
+#include "../src/vm.h"
+#include "common.h"
+#include "table.h"
+
+// enough keys for big tables to be rehashed incrementally a few times
+#define KEY_COUNT 20000
+
+// how many objects to use as keys while they're moved by the GC
+#define OBJ_KEY_COUNT 1000
+#define OBJ_KEY_SPACING 4
+
+// how many keys are live at once while churning through them
+#define WINDOW 500
+
+static void test_rehashing() {
+  static Value keys[KEY_COUNT];
+  static bool deleted[KEY_COUNT];
+  char buf[32];
+  for (int i = 0; i < KEY_COUNT; i++) {
+    int len = snprintf(buf, sizeof(buf), "key%d", i);
+    push(OBJ_VAL((Obj*) copy_string(buf, len)));
+
+    // (rooted in the globals, since there are too many for the stack;
+    // objects only move at safepoints, so `keys` stays valid throughout)
+    table_set(&vm.globals, vm.stack_top[-1], NIL_VAL);
+    keys[i] = pop();
+  }
+
+  Table tab;
+  init_table(&tab);
+
+  // overwrite and delete while entries are being moved between buckets
+  for (int i = 0; i < KEY_COUNT; i++) {
+    assert(table_set(&tab, keys[i], NUMBER_VAL(i)));
+    if (i % 7 == 0) refute(table_set(&tab, keys[i], NUMBER_VAL(-i)));
+    if (i % 3 == 0) {
+      assert(table_delete(&tab, keys[i / 2]));
+      deleted[i / 2] = true;
+    }
+  }
+
+  Value val;
+  size_t live = 0;
+  for (int i = 0; i < KEY_COUNT; i++) {
+    if (deleted[i]) {
+      refute(table_get(&tab, keys[i], &val));
+    } else {
+      assert(table_get(&tab, keys[i], &val));
+      assert(AS_NUMBER(val) == (i % 7 == 0 ? -i : i));
+      live++;
+    }
+  }
+
+  size_t count = 0;
+  size_t cursor = 0;
+  while (table_next(&tab, &cursor) != NULL) count++;
+  assert(count == live);
+
+  // interned strings are found by their characters, wherever they are
+  for (int i = 0; i < KEY_COUNT; i++) {
+    ObjString* key = AS_STRING(keys[i]);
+    assert(table_find_string(&vm.strings, key->chars, key->len, key->hash) == key);
+  }
+  assert(table_find_string(&vm.strings, "nope", 4, AS_STRING(keys[0])->hash) == NULL);
+
+  free_table(&tab);
+  for (int i = 0; i < KEY_COUNT; i++) table_delete(&vm.globals, keys[i]);
+}
+
+static void test_value_keys() {
+  Table tab;
+  init_table(&tab);
+
+  Value val;
+  ObjString* str = copy_string("1", 1);
+  push(OBJ_VAL((Obj*) str)); // (keep it rooted)
+
+  // keys of different types never collide with each other
+  assert(table_set(&tab, NUMBER_VAL(1), NUMBER_VAL(10)));
+  assert(table_set(&tab, OBJ_VAL((Obj*) str), NUMBER_VAL(20)));
+  assert(table_set(&tab, BOOL_VAL(true), NUMBER_VAL(30)));
+  assert(table_set(&tab, BOOL_VAL(false), NUMBER_VAL(40)));
+  assert(table_set(&tab, NIL_VAL, NUMBER_VAL(50)));
+  assert(tab.len == 5);
+
+  assert(table_get(&tab, NUMBER_VAL(1), &val) && AS_NUMBER(val) == 10);
+  assert(table_get(&tab, OBJ_VAL((Obj*) str), &val) && AS_NUMBER(val) == 20);
+  assert(table_get(&tab, BOOL_VAL(true), &val) && AS_NUMBER(val) == 30);
+  assert(table_get(&tab, BOOL_VAL(false), &val) && AS_NUMBER(val) == 40);
+  assert(table_get(&tab, NIL_VAL, &val) && AS_NUMBER(val) == 50);
+  refute(table_get(&tab, NUMBER_VAL(2), &val));
+
+  // 0 and -0 are the same key, as are all NaNs
+  assert(table_set(&tab, NUMBER_VAL(0.0), NUMBER_VAL(60)));
+  refute(table_set(&tab, NUMBER_VAL(-0.0), NUMBER_VAL(61)));
+  assert(table_get(&tab, NUMBER_VAL(0.0), &val) && AS_NUMBER(val) == 61);
+
+  assert(table_set(&tab, NUMBER_VAL(NAN), NUMBER_VAL(70)));
+  refute(table_set(&tab, NUMBER_VAL(-NAN), NUMBER_VAL(71)));
+  assert(table_get(&tab, NUMBER_VAL(sqrt(-1)), &val) && AS_NUMBER(val) == 71);
+
+  assert(table_delete(&tab, NUMBER_VAL(-0.0)));
+  refute(table_get(&tab, NUMBER_VAL(0.0), &val));
+
+  // enough numbers to grow (and incrementally rehash) the table
+  for (int i = 0; i < KEY_COUNT; i++) table_set(&tab, NUMBER_VAL(i + 0.5), NUMBER_VAL(i));
+  for (int i = 0; i < KEY_COUNT; i++) {
+    assert(table_get(&tab, NUMBER_VAL(i + 0.5), &val) && AS_NUMBER(val) == i);
+  }
+
+  free_table(&tab);
+  pop();
+}
+
+static void test_shrinking() {
+  Table tab;
+  init_table(&tab);
+
+  for (int i = 0; i < KEY_COUNT; i++) table_set(&tab, NUMBER_VAL(i), NUMBER_VAL(i));
+  size_t full_cap = tab.cap;
+
+  // deleting most of the keys shrinks the table as it goes
+  for (int i = 100; i < KEY_COUNT; i++) assert(table_delete(&tab, NUMBER_VAL(i)));
+  assert(tab.cap < full_cap);
+
+  Value val;
+  for (int i = 0; i < KEY_COUNT; i++) {
+    if (i < 100) assert(table_get(&tab, NUMBER_VAL(i), &val) && AS_NUMBER(val) == i);
+    else         refute(table_get(&tab, NUMBER_VAL(i), &val));
+  }
+
+  // (a big table is shrunk incrementally, and keeps shrinking as later
+  // lookups finish moving it)
+  assert(tab.cap == 256 && tab.old_cap == 0);
+
+  // and compacting it leaves it without any tombstones
+  table_compact(&tab);
+  assert(tab.cap == 256);
+  assert(tab.len == 100 && tab.tombstones == 0);
+  for (int i = 0; i < 100; i++) assert(table_get(&tab, NUMBER_VAL(i), &val) && AS_NUMBER(val) == i);
+
+  // (or gives its buckets back, once it's empty)
+  for (int i = 0; i < 100; i++) assert(table_delete(&tab, NUMBER_VAL(i)));
+  table_compact(&tab);
+  assert(tab.cap == 0 && table_bytes(&tab) == 0);
+
+  refute(table_get(&tab, NUMBER_VAL(0), &val));
+
+  // compacting also shrinks a table that isn't quite sparse enough for
+  // deletes to have done it
+  for (int i = 0; i < 1000; i++) table_set(&tab, NUMBER_VAL(i), NUMBER_VAL(i));
+  for (int i = 300; i < 1000; i++) assert(table_delete(&tab, NUMBER_VAL(i)));
+  assert(tab.cap == 2048);
+
+  table_compact(&tab);
+  assert(tab.cap == 1024 && tab.tombstones == 0);
+  for (int i = 0; i < 1000; i++) assert(table_get(&tab, NUMBER_VAL(i), &val) == (i < 300));
+
+  free_table(&tab);
+}
+
+static void test_tombstones() {
+  Table tab;
+  init_table(&tab);
+
+  // a queue of keys: each one's deleted a while after it's added, so
+  // the table is forever turning buckets into tombstones
+  Value val;
+  size_t max_cap = 0;
+  for (int i = 0; i < KEY_COUNT; i++) {
+    assert(table_set(&tab, NUMBER_VAL(i), NUMBER_VAL(i)));
+    if (i >= WINDOW) assert(table_delete(&tab, NUMBER_VAL(i - WINDOW)));
+
+    assert(tab.tombstones <= tab.cap / 4 + 1);
+    if (tab.cap > max_cap) max_cap = tab.cap;
+  }
+
+  // ...but they're purged before they can make it grow
+  assert(max_cap <= 2048);
+
+  for (int i = 0; i < KEY_COUNT; i++) {
+    if (i < KEY_COUNT - WINDOW) refute(table_get(&tab, NUMBER_VAL(i), &val));
+    else                        assert(table_get(&tab, NUMBER_VAL(i), &val) && AS_NUMBER(val) == i);
+  }
+
+  free_table(&tab);
+}
+
+// objects are hashed by their address, so when the GC moves one,
+// its entry has to move with it
+static void test_moved_keys() {
+  vm.minor_gc_pending = true; // (start with an empty nursery)
+  gc_safepoint();
+
+  // (each key is followed by a few objects that are about to become
+  // garbage, so that the slabs they're promoted into end up sparse)
+  for (int i = 0; i < OBJ_KEY_COUNT; i++) {
+    push(OBJ_VAL((Obj*) new_function()));
+    table_set(&vm.globals, vm.stack_top[-1], NUMBER_VAL(i));
+
+    for (int j = 1; j < OBJ_KEY_SPACING; j++) push(OBJ_VAL((Obj*) new_function()));
+  }
+
+  Value val;
+  Value* keys = vm.stack;
+  assert(IS_YOUNG(AS_OBJ(keys[0])));
+
+  // (promoted out of the nursery)
+  vm.minor_gc_pending = true;
+  gc_safepoint();
+  for (int i = 0; i < OBJ_KEY_COUNT; i++) {
+    Value key = keys[i * OBJ_KEY_SPACING];
+    assert(!IS_YOUNG(AS_OBJ(key)));
+    assert(table_get(&vm.globals, key, &val) && AS_NUMBER(val) == i);
+  }
+
+  // (evacuated from the slabs they were promoted into)
+  Obj* first = AS_OBJ(keys[0]);
+  for (int i = 0; i < OBJ_KEY_COUNT * OBJ_KEY_SPACING; i++) {
+    if (i % OBJ_KEY_SPACING != 0) keys[i] = NIL_VAL;
+  }
+
+  collect_garbage();
+  vm.compact_pending = true;
+  gc_safepoint();
+  assert(AS_OBJ(keys[0]) != first);
+
+  for (int i = 0; i < OBJ_KEY_COUNT; i++) {
+    Value key = keys[i * OBJ_KEY_SPACING];
+    assert(table_get(&vm.globals, key, &val) && AS_NUMBER(val) == i);
+  }
+
+  vm.stack_top = vm.stack;
+}
+
+void test_table() {
+  init_vm();
+
+  test_rehashing();
+  test_value_keys();
+  test_shrinking();
+  test_tombstones();
+  test_moved_keys();
+
+  free_vm();
+}
+
+// ---
+
+#undef KEY_COUNT
+#undef OBJ_KEY_COUNT
+#undef OBJ_KEY_SPACING
+#undef WINDOW
@@ -0,0 +1,6 @@
+#ifndef __TEST_TABLE_H__
+#define __TEST_TABLE_H__
+
+void test_table();
+
+#endif // __TEST_TABLE_H__
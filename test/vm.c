@@ -0,0 +1,51 @@
+#include <stdio.h>
+#include <string.h>
+#include "../src/logger.h"
+#include "../src/vm.h"
+#include "common.h"
+#include "vm.h"
+
+static char*  out_buf;
+static size_t out_len;
+
+// (runtime errors, like running out of memory, are always reported on
+// stderr, so the first script's error will show up in the test output)
+static void test_out_of_memory() {
+  FILE* out = open_memstream(&out_buf, &out_len);
+  logger_redirect_out(out);
+
+  init_vm();
+  vm.max_heap = 1024 * 1024;
+
+  // the string doubles until it can't fit under the limit
+  InterpretResult res = interpret("var s = \"x\";\n"
+                                  "for (var i = 0; i < 64; i = i + 1) s = s + s;\n"
+                                  "print \"unreachable\";\n");
+  fflush(out);
+  assert(res == INTERPRET_RUNTIME_ERR);
+  assert(out_len == 0);
+  assert(vm.frame_count == 0);
+  assert(vm.stack_top == vm.stack);
+  assert(vm.out_of_memory == NULL);
+  assert(!vm.in_gc);
+
+  // having unwound, the same VM can still run scripts (and the doubled
+  // string is garbage once it's dropped, so there's room again)
+  res = interpret("s = nil;\n"
+                  "var t = \"a\" + \"b\";\n"
+                  "for (var i = 0; i < 10; i = i + 1) t = t + t;\n"
+                  "print \"ok\";\n");
+  fflush(out);
+  assert(res == INTERPRET_OK);
+  assert(strcmp(out_buf, "ok\n") == 0);
+
+  free_vm();
+
+  logger_restore_out();
+  fclose(out);
+  free(out_buf);
+}
+
+void test_vm() {
+  test_out_of_memory();
+}
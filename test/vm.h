@@ -0,0 +1,6 @@
+#ifndef __TEST_VM_H__
+#define __TEST_VM_H__
+
+void test_vm();
+
+#endif // __TEST_VM_H__